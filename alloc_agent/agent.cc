@@ -0,0 +1,206 @@
+// Allocation tracking agent, preloaded into the traced process.
+// Interposes the allocation functions and reports each call to the monitor
+// through the AllocRing in shared memory, whose fd is given in the
+// environment.
+
+#include "monitor_lib/alloc_ring.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+void *__libc_memalign(std::size_t alignment, std::size_t size);
+void *__libc_valloc(std::size_t size);
+void *__libc_pvalloc(std::size_t size);
+void __libc_free(void *ptr);
+}
+
+#define AGENT_VISIBLE __attribute__((visibility("default")))
+#define AGENT_EXPORT extern "C" AGENT_VISIBLE
+
+using Whiteboard::AllocEvent;
+using Whiteboard::AllocRing;
+
+namespace {
+
+AllocRing *ring = nullptr;
+
+// initial-exec, so that accessing it doesn't allocate
+__thread std::uint32_t threadId
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+void detachInForkedChild() { ring = nullptr; }
+
+__attribute__((constructor)) void attach() {
+  const char *fdString = std::getenv(Whiteboard::allocRingFdVariable);
+  if (!fdString)
+    return;
+  int fd = std::atoi(fdString);
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0)
+    return;
+  void *memory = ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED)
+    return;
+
+  // processes started from here are not tracked
+  ::unsetenv(Whiteboard::allocRingFdVariable);
+  ::unsetenv("LD_PRELOAD");
+  ::pthread_atfork(nullptr, nullptr, detachInForkedChild);
+
+  ring = AllocRing::attach(memory, st.st_size);
+}
+
+void report(AllocEvent::Kind kind, void *address, std::size_t size,
+            void *caller) {
+  AllocRing *r = ring;
+  if (!r || !address)
+    return;
+  if (threadId == 0)
+    threadId = ::gettid();
+
+  AllocEvent event{kind, threadId, reinterpret_cast<std::uint64_t>(address),
+                   size, reinterpret_cast<std::uint64_t>(caller)};
+  // the monitor drains the ring continuously, wait for it rather than lose
+  // the event
+  while (!r->tryPush(event))
+    ::sched_yield();
+}
+
+void *allocate(std::size_t size, void *caller) {
+  void *ptr = __libc_malloc(size);
+  report(AllocEvent::Kind::Alloc, ptr, size, caller);
+  return ptr;
+}
+
+void deallocate(void *ptr, void *caller) {
+  // reported before the block can be reused by another thread
+  report(AllocEvent::Kind::Free, ptr, 0, caller);
+  __libc_free(ptr);
+}
+
+void *allocateOrThrow(std::size_t size, void *caller) {
+  while (true) {
+    if (void *ptr = allocate(size, caller))
+      return ptr;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+} // namespace
+
+#define CALLER __builtin_return_address(0)
+
+AGENT_EXPORT void *malloc(std::size_t size) { return allocate(size, CALLER); }
+
+AGENT_EXPORT void free(void *ptr) { deallocate(ptr, CALLER); }
+
+AGENT_EXPORT void *calloc(std::size_t count, std::size_t size) {
+  void *ptr = __libc_calloc(count, size);
+  report(AllocEvent::Kind::Alloc, ptr, count * size, CALLER);
+  return ptr;
+}
+
+AGENT_EXPORT void *realloc(void *ptr, std::size_t size) {
+  void *newPtr = __libc_realloc(ptr, size);
+  // realloc(ptr, 0) frees
+  if (newPtr || size == 0)
+    report(AllocEvent::Kind::Free, ptr, 0, CALLER);
+  report(AllocEvent::Kind::Alloc, newPtr, size, CALLER);
+  return newPtr;
+}
+
+AGENT_EXPORT int posix_memalign(void **out, std::size_t alignment,
+                                std::size_t size) {
+  // a power of two multiple of sizeof(void *), as POSIX requires
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+      alignment % sizeof(void *) != 0)
+    return EINVAL;
+  void *ptr = __libc_memalign(alignment, size);
+  if (!ptr)
+    return ENOMEM;
+  report(AllocEvent::Kind::Alloc, ptr, size, CALLER);
+  *out = ptr;
+  return 0;
+}
+
+AGENT_EXPORT void *aligned_alloc(std::size_t alignment, std::size_t size) {
+  void *ptr = __libc_memalign(alignment, size);
+  report(AllocEvent::Kind::Alloc, ptr, size, CALLER);
+  return ptr;
+}
+
+AGENT_EXPORT void *memalign(std::size_t alignment, std::size_t size) {
+  void *ptr = __libc_memalign(alignment, size);
+  report(AllocEvent::Kind::Alloc, ptr, size, CALLER);
+  return ptr;
+}
+
+AGENT_EXPORT void *valloc(std::size_t size) {
+  void *ptr = __libc_valloc(size);
+  report(AllocEvent::Kind::Alloc, ptr, size, CALLER);
+  return ptr;
+}
+
+AGENT_EXPORT void *pvalloc(std::size_t size) {
+  void *ptr = __libc_pvalloc(size);
+  // the size is rounded up to whole pages, at least one, all usable
+  std::size_t page = ::sysconf(_SC_PAGESIZE);
+  std::size_t pages = std::max<std::size_t>((size + page - 1) / page, 1);
+  report(AllocEvent::Kind::Alloc, ptr, pages * page, CALLER);
+  return ptr;
+}
+
+// operator new/delete are interposed too, so that the caller is the user code
+// rather than the C++ runtime
+
+AGENT_VISIBLE void *operator new(std::size_t size) {
+  return allocateOrThrow(size, CALLER);
+}
+
+AGENT_VISIBLE void *operator new[](std::size_t size) {
+  return allocateOrThrow(size, CALLER);
+}
+
+AGENT_VISIBLE void *operator new(std::size_t size,
+                                const std::nothrow_t &) noexcept {
+  return allocate(size, CALLER);
+}
+
+AGENT_VISIBLE void *operator new[](std::size_t size,
+                                  const std::nothrow_t &) noexcept {
+  return allocate(size, CALLER);
+}
+
+AGENT_VISIBLE void operator delete(void *ptr) noexcept {
+  deallocate(ptr, CALLER);
+}
+
+AGENT_VISIBLE void operator delete[](void *ptr) noexcept {
+  deallocate(ptr, CALLER);
+}
+
+AGENT_VISIBLE void operator delete(void *ptr, std::size_t) noexcept {
+  deallocate(ptr, CALLER);
+}
+
+AGENT_VISIBLE void operator delete[](void *ptr, std::size_t) noexcept {
+  deallocate(ptr, CALLER);
+}
\ No newline at end of file
@@ -1,28 +1,89 @@
 
 #include "monitor_lib/logging.hh"
 #include "monitor_lib/monitor.hh"
+#include "monitor_lib/source_cache.hh"
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include <cassert>
 
 using namespace std::literals;
 
-int main(int argc, char **argv) {
+namespace {
 
-  if (argc < 2) {
-    fmt::print("Argument required\n");
-    return 1;
+struct Break {
+  std::string location; // a function, or <file>:<line>
+  std::optional<std::string> condition;
+  std::uint64_t ignoreCount = 0;
+};
+
+// ids are the positions on the command line, from 1
+void setBreakpoints(Whiteboard::Monitor &m, const std::vector<Break> &breaks) {
+  for (std::size_t i = 0; i < breaks.size(); ++i) {
+    Whiteboard::breakpoint_id id = i + 1;
+    const std::string &location = breaks[i].location;
+    auto colon = location.rfind(':');
+    // not the :: of a qualified function name
+    bool atLine =
+        colon != std::string::npos && colon > 0 && location[colon - 1] != ':' &&
+        colon + 1 < location.size() &&
+        std::ranges::all_of(location.substr(colon + 1),
+                            [](char c) { return c >= '0' && c <= '9'; });
+    if (atLine)
+      m.breakAtLine(location.substr(0, colon),
+                    std::stoi(location.substr(colon + 1)), id);
+    else
+      m.breakAtFunction(location, id);
+    if (breaks[i].condition || breaks[i].ignoreCount > 0) {
+      m.setBreakpointCondition(
+          id,
+          breaks[i].condition
+              ? Whiteboard::BreakCondition::parse(*breaks[i].condition)
+              : Whiteboard::BreakCondition(),
+          breaks[i].ignoreCount);
+    }
   }
+}
 
-  Whiteboard::Logging::setLogLevel(Whiteboard::Logging::LogLevel::Trace);
+void printBacktrace(Whiteboard::Monitor &m) {
+  const auto &debugInfo = m.debugInfo();
+  auto frames = m.backtrace();
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    auto function = debugInfo.findFunctionName(frames[i]);
+    auto location = debugInfo.findSourceLocation(frames[i]);
+    fmt::println("#{:<3} 0x{:016x} in {} at {}", i, frames[i],
+                 function.value_or("??"),
+                 location ? fmt::format("{}", *location) : "??");
+  }
+}
 
-  const char *executable = argv[1];
+void printLocals(Whiteboard::Monitor &m) {
+  for (const auto &value : m.readLocals()) {
+    const auto &variable = *value.variable;
+    fmt::println("  {} {} = {}",
+                 variable.type ? variable.type->name : "<unknown type>",
+                 variable.name,
+                 value.bytes && variable.type
+                     ? Whiteboard::formatValue(*variable.type, *value.bytes)
+                     : "<unavailable>");
+  }
+}
 
-  Whiteboard::Monitor::Args args = {executable, "1", "2"};
-  Whiteboard::Monitor m = Whiteboard::Monitor::runExecutable(executable, args);
+// steps through main, instruction by instruction, reporting source locations
+// and optionally their source text and the local variables at each
+void runStepping(Whiteboard::Monitor &m, const char *executable,
+                 bool showLocals = false, bool showSource = false) {
 
   Whiteboard::breakpoint_id mainBreakpointId = 77;
   m.breakAtFunction("main", mainBreakpointId);
@@ -31,6 +92,7 @@ int main(int argc, char **argv) {
   auto state = m.cont();
   std::optional<Whiteboard::SourceLocation> lastLocation;
   unsigned instructions = 0;
+  Whiteboard::SourceCache sources;
 
   while (m.isRunning()) {
     fmt::print("process stopped\n");
@@ -43,6 +105,7 @@ int main(int argc, char **argv) {
       auto registers = m.registers();
       mainStackTop = registers[Whiteboard::Registers::Names::SP];
       fmt::println("main stack top: {}", mainStackTop);
+      printBacktrace(m);
 
       // iterate over the instructions, until leaving stack
       while (true) {
@@ -63,7 +126,15 @@ int main(int argc, char **argv) {
           Whiteboard::Logging::trace("source loc: {}", *maybeLocation);
           if (!lastLocation || *lastLocation != *maybeLocation) {
             fmt::println("EVENT: source loc: {}", *maybeLocation);
+            if (showSource) {
+              auto text =
+                  sources.line(maybeLocation->file(), maybeLocation->line());
+              fmt::println("  {:>5} | {}", maybeLocation->line(),
+                           text.value_or("<source unavailable>"));
+            }
             lastLocation = *maybeLocation;
+            if (showLocals)
+              printLocals(m);
           }
         }
 
@@ -83,3 +154,449 @@ int main(int argc, char **argv) {
   fmt::println("Process {} finished. Processed {} instructions", executable,
                instructions);
 }
+
+// runs the process freely, printing the sampled profile at exit
+void runSampling(Whiteboard::Monitor &m, const char *executable,
+                 std::chrono::microseconds interval) {
+
+  Whiteboard::Profile profile;
+  while (m.isRunning())
+    m.sample(interval, profile);
+
+  auto summary = profile.summarize(m.debugInfo());
+  fmt::println("Process {} finished. Collected {} samples ({} unresolved), "
+               "stack depth {} bytes",
+               executable, summary.totalSamples, summary.unresolvedSamples,
+               summary.stackDepth);
+
+  constexpr std::size_t topN = 20;
+  auto percent = [&](std::uint64_t samples) {
+    return 100.0 * samples / std::max<std::uint64_t>(summary.totalSamples, 1);
+  };
+
+  fmt::println("Top functions (samples, share, deepest stack in bytes):");
+  for (std::size_t i = 0; i < std::min(topN, summary.functions.size()); ++i) {
+    const auto &bucket = summary.functions[i];
+    fmt::println("{:>10} {:>6.2f}% {:>8}  {}", bucket.samples,
+                 percent(bucket.samples), bucket.stackDepth, bucket.key);
+  }
+
+  fmt::println("Top lines:");
+  for (std::size_t i = 0; i < std::min(topN, summary.lines.size()); ++i) {
+    const auto &bucket = summary.lines[i];
+    fmt::println("{:>10} {:>6.2f}%  {}", bucket.samples,
+                 percent(bucket.samples), bucket.key);
+  }
+}
+
+// runs the process, tracing calls of the given functions
+void runCallTracing(Whiteboard::Monitor &m, const char *executable,
+                    const std::vector<std::string> &functions) {
+
+  for (const auto &function : functions)
+    m.traceFunction(function);
+
+  Whiteboard::CallTrace trace;
+  while (m.isRunning())
+    m.traceCalls(trace);
+
+  fmt::println("Process {} finished", executable);
+
+  fmt::println("Functions:");
+  for (const auto &[function, stats] : trace.functions()) {
+    auto inclusive = std::chrono::duration_cast<std::chrono::microseconds>(
+        stats.inclusiveTime);
+    fmt::println("{:>10} calls {:>12} us  {}", stats.calls, inclusive.count(),
+                 function);
+  }
+
+  fmt::println("Calls:");
+  for (const auto &[edge, calls] : trace.edges()) {
+    fmt::println("{:>10}  {} -> {}", calls, edge.first, edge.second);
+  }
+}
+
+void printMemoryChanges(Whiteboard::Monitor &m,
+                        Whiteboard::Snapshot &snapshot) {
+  auto changes = m.updateSnapshot(snapshot);
+  fmt::println("Memory changed in {} pages ({} read):", changes.size(),
+               snapshot.stats().pagesRead);
+  for (const auto &change : changes) {
+    std::string ranges;
+    for (auto [begin, end] : change.ranges)
+      ranges += fmt::format(" +0x{:x}..0x{:x}", begin, end);
+    fmt::println("  0x{:016x} {}:{}{}", change.page, change.region, ranges,
+                 change.newPage ? " (new page)" : "");
+  }
+}
+
+// runs the process collecting line coverage, written to an lcov tracefile
+void runCoverage(Whiteboard::Monitor &m, const char *executable,
+                 const std::string &lcovPath) {
+
+  Whiteboard::Coverage coverage;
+  while (m.isRunning())
+    m.collectCoverage(coverage);
+
+  std::ofstream lcov(lcovPath);
+  coverage.writeLcov(lcov);
+  if (!lcov) {
+    fmt::println("Failed to write {}", lcovPath);
+    return;
+  }
+
+  fmt::println("Process {} finished. Coverage written to {}", executable,
+               lcovPath);
+  for (const auto &file : coverage.summarize()) {
+    fmt::println("{:>6.2f}% {:>6}/{:<6} {}",
+                 100.0 * file.coveredLines / std::max(file.lines, 1u),
+                 file.coveredLines, file.lines, file.file);
+  }
+}
+
+// runs the process to completion, reporting the traced syscalls and
+// breakpoint hits. With `diffMemory`, also the memory changed between
+// consecutive breakpoint hits.
+void runFreely(Whiteboard::Monitor &m, const char *executable,
+               bool diffMemory = false) {
+
+  unsigned syscalls = 0;
+  std::optional<Whiteboard::Snapshot> snapshot;
+  while (m.isRunning()) {
+    auto state = m.cont();
+    if (state.reason == Whiteboard::Monitor::StopReason::Syscall) {
+      fmt::println("EVENT syscall: {}", *state.syscall);
+      ++syscalls;
+    } else if (state.reason == Whiteboard::Monitor::StopReason::Breakpoint) {
+      fmt::println("EVENT breakpoint {}", state.breakpoint);
+      printBacktrace(m);
+      if (diffMemory && snapshot)
+        printMemoryChanges(m, *snapshot);
+      else if (diffMemory)
+        snapshot.emplace(m.takeSnapshot());
+    }
+  }
+
+  fmt::println("Process {} finished. Traced {} syscalls", executable,
+               syscalls);
+}
+
+// Runs the process and its descendants to completion, reporting the
+// breakpoint hits, forks and execs. Each child is traced by a thread of its
+// own, which ends after it.
+void runFollowing(Whiteboard::Monitor &m) {
+  using StopReason = Whiteboard::Monitor::StopReason;
+
+  std::vector<std::jthread> children;
+  while (m.isRunning()) {
+    auto state = m.cont();
+    if (state.child) {
+      fmt::println("EVENT [{}] fork: {}", m.pid(), state.child->pid);
+      children.emplace_back([child = *state.child] {
+        try {
+          auto m = Whiteboard::Monitor::attachChild(child);
+          runFollowing(m);
+        } catch (const std::exception &e) {
+          fmt::println("Failed to follow process {}: {}", child.pid,
+                       e.what());
+        }
+      });
+    }
+    if (state.reason == StopReason::Exec) {
+      fmt::println("EVENT [{}] exec: {}", m.pid(), m.executable());
+    } else if (state.reason == StopReason::Breakpoint) {
+      auto function = m.debugInfo().findFunctionName(
+          m.registers()[Whiteboard::Registers::IP].get64());
+      fmt::println("EVENT [{}] breakpoint {} in {}", m.pid(), state.breakpoint,
+                   function.value_or("??"));
+    }
+  }
+  fmt::println("EVENT [{}] finished", m.pid());
+}
+
+// runs the process freely, counting hits of fast tracepoints at the functions
+void runWithTracepoints(Whiteboard::Monitor &m, const char *executable,
+                        const std::vector<std::string> &functions) {
+
+  std::vector<std::string> names;
+  for (const auto &function : functions) {
+    auto id = m.addFunctionTracepoint(function);
+    names.resize(id + 1);
+    names[id] = function;
+  }
+
+  // hits are collected while the process runs, not to lose them
+  std::vector<std::uint64_t> counts(names.size());
+  std::uint64_t lost = 0;
+  auto collect = [&] {
+    std::vector<Whiteboard::TracepointHit> hits;
+    lost += m.collectTracepointHits(hits);
+    for (const auto &hit : hits)
+      ++counts[hit.tracepoint];
+    return hits.size();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::jthread collector([&](std::stop_token stop) {
+      while (!stop.stop_requested()) {
+        if (collect() == 0)
+          std::this_thread::sleep_for(1ms);
+      }
+    });
+    runFreely(m, executable);
+  }
+  collect();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  fmt::println("Tracepoints ({} hits lost):", lost);
+  for (std::size_t id = 0; id < names.size(); ++id) {
+    fmt::println("{:>12} hits {:>12.0f}/s  {}", counts[id],
+                 counts[id] / elapsed.count(), names[id]);
+  }
+}
+
+// Runs `instances` processes of the executable to completion, on as many
+// threads as there are cores, counting the stops of each. The debug info of
+// the executable is loaded once, shared by all the monitors.
+void runBatch(const char *executable,
+              const Whiteboard::Monitor::RunOptions &runOptions,
+              const std::vector<Break> &breaks, unsigned instances) {
+
+  struct Result {
+    unsigned breakpointHits = 0;
+    unsigned syscalls = 0;
+    std::chrono::duration<double, std::milli> elapsed{};
+    std::string error;
+  };
+  std::vector<Result> results(instances);
+  std::atomic<unsigned> next = 0;
+
+  // each process is traced by the thread that started it
+  auto worker = [&] {
+    for (unsigned i = next++; i < instances; i = next++) {
+      Result &result = results[i];
+      auto start = std::chrono::steady_clock::now();
+      try {
+        Whiteboard::Monitor::Args args = {executable, "1", "2"};
+        Whiteboard::Monitor m = Whiteboard::Monitor::runExecutable(
+            executable, args, runOptions);
+        setBreakpoints(m, breaks);
+        while (m.isRunning()) {
+          auto state = m.cont();
+          if (state.reason == Whiteboard::Monitor::StopReason::Breakpoint)
+            ++result.breakpointHits;
+          else if (state.reason == Whiteboard::Monitor::StopReason::Syscall)
+            ++result.syscalls;
+        }
+      } catch (const std::exception &e) {
+        result.error = e.what();
+      }
+      result.elapsed = std::chrono::steady_clock::now() - start;
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    unsigned threads =
+        std::clamp(std::thread::hardware_concurrency(), 1u, instances);
+    std::vector<std::jthread> workers;
+    for (unsigned i = 0; i < threads; ++i)
+      workers.emplace_back(worker);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  for (unsigned i = 0; i < instances; ++i) {
+    const Result &result = results[i];
+    if (!result.error.empty()) {
+      fmt::println("#{:<4} failed: {}", i, result.error);
+      continue;
+    }
+    fmt::println("#{:<4} {:>8.1f} ms, {} breakpoint hits, {} syscalls", i,
+                 result.elapsed.count(), result.breakpointHits,
+                 result.syscalls);
+  }
+  fmt::println("{} processes of {} finished in {:.1f} ms", instances,
+               executable, elapsed.count());
+}
+
+void printAllocations(Whiteboard::Monitor &m) {
+  auto summary = m.allocTracker()->summarize(m.debugInfo());
+  fmt::println("Allocations: {} ({} bytes), frees: {}", summary.allocations,
+               summary.allocatedBytes, summary.frees);
+  fmt::println("Peak heap: {} bytes, live: {} bytes in {} blocks",
+               summary.peakBytes, summary.liveBytes, summary.liveBlocks);
+
+  fmt::println("Allocation sizes:");
+  for (const auto &bucket : summary.sizes)
+    fmt::println("{:>12} {:>10}", fmt::format("<= {}", bucket.maxSize),
+                 bucket.allocations);
+
+  constexpr std::size_t topN = 20;
+  fmt::println("Leaks:");
+  for (std::size_t i = 0; i < std::min(topN, summary.leaks.size()); ++i) {
+    const auto &leak = summary.leaks[i];
+    fmt::println("{:>10} bytes in {:>6} blocks  {} at {}", leak.bytes,
+                 leak.blocks, leak.function, leak.location);
+  }
+}
+
+void printStats(const Whiteboard::Monitor &m) {
+  using Phase = Whiteboard::MonitorStats::Phase;
+  auto stats = m.stats();
+  using StopReason = Whiteboard::Monitor::StopReason;
+  std::string stops;
+  for (std::size_t i = 0; i < stats.stops.size(); ++i) {
+    stops += fmt::format("{}{} {}", i == 0 ? "" : ", ", stats.stops[i],
+                         Whiteboard::Monitor::stopReasonName(StopReason(i)));
+  }
+  fmt::println("Stops: {}", stops);
+  fmt::println("Breakpoint hits: {}, filtered by conditions: {}",
+               stats.breakpointHits, stats.filteredHits);
+  fmt::println("ptrace calls: {}, bytes read: {}", stats.ptraceCalls,
+               stats.bytesRead);
+
+  double ticksPerUs = stats.ticksPerMicrosecond();
+  fmt::println("{:<18} {:>8} {:>10} {:>10} {:>10} {:>10}", "phase (us)",
+               "count", "mean", "p50", "p99", "max");
+  for (std::size_t i = 0; i < Whiteboard::MonitorStats::numPhases; ++i) {
+    const auto &h = stats.phases[i];
+    if (h.count() == 0)
+      continue;
+    fmt::println("{:<18} {:>8} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f}",
+                 Whiteboard::MonitorStats::phaseName(Phase(i)), h.count(),
+                 h.totalTicks() / ticksPerUs / h.count(),
+                 h.percentileTicks(0.5) / ticksPerUs,
+                 h.percentileTicks(0.99) / ticksPerUs,
+                 h.maxTicks() / ticksPerUs);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  // usage: monitor [--sample <interval-us>] [--trace <function>]...
+  //                [--coverage <lcov-file>]
+  //                [--syscalls <name>[,<name>]...] [--allocs]
+  //                [--tracepoint <function>]...
+  //                [--break <function>|<file>:<line> [--if <condition>]
+  //                 [--ignore <n>]]...
+  //                [--diff] [--locals] [--source] [--stats] [--batch <n>]
+  //                [--follow] <executable>
+  std::optional<std::chrono::microseconds> sampleInterval;
+  std::vector<std::string> tracedFunctions;
+  std::vector<std::string> tracepointFunctions;
+  std::optional<std::string> coveragePath;
+  std::vector<Break> breaks;
+  bool diffMemory = false;
+  bool showLocals = false;
+  bool showSource = false;
+  bool showStats = false;
+  unsigned batchSize = 0;
+  Whiteboard::Monitor::RunOptions runOptions;
+
+  int argi = 1;
+  while (argi < argc && argv[argi][0] == '-') {
+    std::string_view option = argv[argi++];
+    if (option == "--sample" && argi < argc) {
+      sampleInterval = std::chrono::microseconds(std::stoul(argv[argi++]));
+    } else if (option == "--trace" && argi < argc) {
+      tracedFunctions.push_back(argv[argi++]);
+    } else if (option == "--coverage" && argi < argc) {
+      coveragePath = argv[argi++];
+    } else if (option == "--tracepoint" && argi < argc) {
+      tracepointFunctions.push_back(argv[argi++]);
+    } else if (option == "--break" && argi < argc) {
+      breaks.push_back(Break{argv[argi++]});
+    } else if (option == "--if" && argi < argc && !breaks.empty()) {
+      breaks.back().condition = argv[argi++];
+    } else if (option == "--ignore" && argi < argc && !breaks.empty()) {
+      breaks.back().ignoreCount = std::stoull(argv[argi++]);
+    } else if (option == "--diff") {
+      diffMemory = true;
+    } else if (option == "--locals") {
+      showLocals = true;
+    } else if (option == "--source") {
+      showSource = true;
+    } else if (option == "--stats") {
+      showStats = true;
+    } else if (option == "--batch" && argi < argc) {
+      batchSize = std::stoul(argv[argi++]);
+    } else if (option == "--follow") {
+      runOptions.followChildren = true;
+    } else if (option == "--allocs") {
+      runOptions.trackAllocations = true;
+    } else if (option == "--syscalls" && argi < argc) {
+      std::string_view names = argv[argi++];
+      while (!names.empty()) {
+        auto name = names.substr(0, names.find(','));
+        names.remove_prefix(std::min(names.size(), name.size() + 1));
+        auto number = Whiteboard::syscallNumber(name);
+        if (!number) {
+          fmt::print("Unknown syscall: {}\n", name);
+          return 1;
+        }
+        runOptions.tracedSyscalls.push_back(*number);
+      }
+    } else {
+      fmt::print("Unknown option: {}\n", option);
+      return 1;
+    }
+  }
+
+  if (argi >= argc) {
+    fmt::print("Argument required\n");
+    return 1;
+  }
+
+  // stepping is the default, unless only the passive tracking is requested
+  bool freeRun =
+      (!runOptions.tracedSyscalls.empty() || runOptions.trackAllocations ||
+       !tracepointFunctions.empty() || !breaks.empty() ||
+       runOptions.followChildren) &&
+      !sampleInterval && tracedFunctions.empty() && !coveragePath;
+  // coverage adds a breakpoint per line, too many to log; and many processes
+  // at once can't be logged either
+  if (coveragePath || batchSize > 0 || runOptions.followChildren)
+    Whiteboard::Logging::setLogLevel(Whiteboard::Logging::LogLevel::Error);
+  else if (sampleInterval || !tracedFunctions.empty() || freeRun)
+    Whiteboard::Logging::setLogLevel(Whiteboard::Logging::LogLevel::Debug);
+  else
+    Whiteboard::Logging::setLogLevel(Whiteboard::Logging::LogLevel::Trace);
+
+  const char *executable = argv[argi];
+
+  if (batchSize > 0) {
+    runBatch(executable, runOptions, breaks, batchSize);
+    return 0;
+  }
+
+  Whiteboard::Monitor::Args args = {executable, "1", "2"};
+  Whiteboard::Monitor m =
+      Whiteboard::Monitor::runExecutable(executable, args, runOptions);
+
+  setBreakpoints(m, breaks);
+
+  if (sampleInterval)
+    runSampling(m, executable, *sampleInterval);
+  else if (coveragePath)
+    runCoverage(m, executable, *coveragePath);
+  else if (!tracedFunctions.empty())
+    runCallTracing(m, executable, tracedFunctions);
+  else if (freeRun && runOptions.followChildren)
+    runFollowing(m);
+  else if (freeRun && !tracepointFunctions.empty())
+    runWithTracepoints(m, executable, tracepointFunctions);
+  else if (freeRun)
+    runFreely(m, executable, diffMemory);
+  else
+    runStepping(m, executable, showLocals, showSource);
+
+  if (m.allocTracker())
+    printAllocations(m);
+  if (showStats)
+    printStats(m);
+}
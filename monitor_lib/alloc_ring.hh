@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Shared between the monitor and the allocation agent preloaded into the
+// traced process, so header-only and without dependencies.
+
+namespace Whiteboard {
+
+// environment variable passing the fd of the shared memory to the agent
+inline constexpr const char *allocRingFdVariable = "WHITEBOARD_ALLOC_RING_FD";
+
+struct AllocEvent {
+  enum class Kind : std::uint32_t { Alloc, Free };
+
+  Kind kind;
+  std::uint32_t tid;
+  std::uint64_t address;
+  std::uint64_t size; // 0 for Free
+  std::uint64_t callerIp;
+};
+
+// Bounded multi-producer, single-consumer queue of allocation events, living
+// in memory shared by the traced process (producers) and the monitor
+// (consumer). Each slot carries a sequence number telling whose turn it is,
+// so neither side ever takes a lock.
+class AllocRing {
+public:
+  static constexpr std::uint64_t magic = 0x676e6952636f6c41; // "AllocRng"
+
+  // memory needed for a ring of `capacity` events, a power of 2
+  static constexpr std::size_t bytesFor(std::uint32_t capacity) {
+    return sizeof(AllocRing) + capacity * sizeof(Slot);
+  }
+
+  // constructs an empty ring in `memory` of at least bytesFor(capacity)
+  static AllocRing *create(void *memory, std::uint32_t capacity) {
+    auto *ring = new (memory) AllocRing(capacity);
+    for (std::uint32_t i = 0; i < capacity; ++i)
+      new (&ring->slots()[i]) Slot{i, {}};
+    return ring;
+  }
+
+  // ring created by the other side, nullptr if `memory` doesn't hold one
+  static AllocRing *attach(void *memory, std::size_t size) {
+    auto *ring = static_cast<AllocRing *>(memory);
+    if (size < sizeof(AllocRing) || ring->_magic != magic ||
+        size < bytesFor(ring->_capacity))
+      return nullptr;
+    return ring;
+  }
+
+  std::uint32_t capacity() const { return _capacity; }
+
+  // producer side, returns false if the ring is full
+  bool tryPush(const AllocEvent &event) {
+    std::uint64_t pos = _head.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = slots()[pos & (_capacity - 1)];
+      std::uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (_head.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          slot.event = event;
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        return false; // not consumed yet
+      } else {
+        pos = _head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // consumer side, returns false if the ring is empty
+  bool tryPop(AllocEvent &event) {
+    std::uint64_t pos = _tail.load(std::memory_order_relaxed);
+    Slot &slot = slots()[pos & (_capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+      return false;
+    event = slot.event;
+    slot.sequence.store(pos + _capacity, std::memory_order_release);
+    _tail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+private:
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "atomics in shared memory must be lock-free");
+
+  struct Slot {
+    std::atomic<std::uint64_t> sequence;
+    AllocEvent event;
+  };
+
+  explicit AllocRing(std::uint32_t capacity) : _capacity(capacity) {}
+
+  Slot *slots() { return reinterpret_cast<Slot *>(this + 1); }
+
+  std::uint64_t _magic = magic;
+  std::uint32_t _capacity;
+  // on separate cache lines, written by the different sides
+  alignas(64) std::atomic<std::uint64_t> _head = 0; // next to write
+  alignas(64) std::atomic<std::uint64_t> _tail = 0; // next to read
+};
+
+} // namespace Whiteboard
\ No newline at end of file
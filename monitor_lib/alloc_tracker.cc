@@ -0,0 +1,127 @@
+#include "alloc_tracker.hh"
+
+#include "logging.hh"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <map>
+#include <tuple>
+
+namespace Whiteboard {
+
+namespace {
+
+constexpr auto drainInterval = std::chrono::milliseconds(1);
+
+} // namespace
+
+AllocTracker::AllocTracker(std::uint32_t ringCapacity)
+    : _memory("whiteboard-alloc-ring",
+              AllocRing::bytesFor(std::bit_ceil(ringCapacity))),
+      _ring(AllocRing::create(_memory.data(), std::bit_ceil(ringCapacity))),
+      _sizeHistogram(65, 0),
+      _drainThread([this](std::stop_token stop) { drainLoop(stop); }) {}
+
+AllocTracker::~AllocTracker() = default;
+
+void AllocTracker::drainLoop(std::stop_token stop) {
+  while (!stop.stop_requested()) {
+    {
+      std::lock_guard lock(_mutex);
+      drain();
+    }
+    std::this_thread::sleep_for(drainInterval);
+  }
+}
+
+void AllocTracker::drain() {
+  AllocEvent event;
+  while (_ring->tryPop(event))
+    onEvent(event);
+}
+
+void AllocTracker::onEvent(const AllocEvent &event) {
+  if (event.kind == AllocEvent::Kind::Alloc) {
+    ++_allocations;
+    _allocatedBytes += event.size;
+    ++_sizeHistogram[std::bit_width(event.size - (event.size > 0))];
+
+    auto [it, inserted] = _liveBlocks.try_emplace(
+        event.address, Block{event.size, event.callerIp});
+    if (!inserted) {
+      // the free was missed, the address has been reused
+      _liveBytes -= it->second.size;
+      it->second = Block{event.size, event.callerIp};
+    }
+    _liveBytes += event.size;
+    _peakBytes = std::max(_peakBytes, _liveBytes);
+  } else {
+    ++_frees;
+    auto it = _liveBlocks.find(event.address);
+    if (it == _liveBlocks.end()) {
+      Logging::trace("AllocTracker: free of unknown block 0x{:x}",
+                     event.address);
+      ++_unknownFrees;
+      return;
+    }
+    _liveBytes -= it->second.size;
+    _liveBlocks.erase(it);
+  }
+}
+
+AllocTracker::Summary
+AllocTracker::summarize(const ProcessDebugInfo &debugInfo) {
+  std::lock_guard lock(_mutex);
+  drain();
+
+  Summary summary;
+  summary.allocations = _allocations;
+  summary.frees = _frees;
+  summary.allocatedBytes = _allocatedBytes;
+  summary.liveBytes = _liveBytes;
+  summary.liveBlocks = _liveBlocks.size();
+  summary.peakBytes = _peakBytes;
+  summary.unknownFrees = _unknownFrees;
+
+  for (std::size_t i = 0; i < _sizeHistogram.size(); ++i) {
+    if (_sizeHistogram[i] > 0) {
+      summary.sizes.push_back(
+          SizeBucket{i < 64 ? 1ull << i : ~0ull, _sizeHistogram[i]});
+    }
+  }
+
+  // symbolize each call site once
+  std::unordered_map<addr_t, Leak> bySite;
+  for (const auto &[address, block] : _liveBlocks) {
+    Leak &leak = bySite[block.callerIp];
+    ++leak.blocks;
+    leak.bytes += block.size;
+  }
+
+  std::map<std::tuple<std::string, std::string>, Leak> byLocation;
+  for (auto &[callerIp, siteLeak] : bySite) {
+    // the return address may belong to the next line already
+    addr_t callIp = callerIp - 1;
+    auto function = debugInfo.findFunctionName(callIp);
+    auto location = debugInfo.findSourceLocation(callIp);
+
+    Leak &leak = byLocation[{function.value_or("??"),
+                             location ? fmt::format("{}", *location)
+                                      : fmt::format("0x{:x}", callerIp)}];
+    leak.blocks += siteLeak.blocks;
+    leak.bytes += siteLeak.bytes;
+  }
+
+  for (auto &[key, leak] : byLocation) {
+    std::tie(leak.function, leak.location) = key;
+    summary.leaks.push_back(std::move(leak));
+  }
+  std::ranges::stable_sort(summary.leaks, std::ranges::greater{},
+                           &Leak::bytes);
+  return summary;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "alloc_ring.hh"
+#include "process_debug_info.hh"
+#include "shared_memory.hh"
+
+#include <cstdint>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+// Heap usage of the traced process, built from events written by the
+// allocation agent (alloc_agent) into a shared ring. The ring is drained by a
+// background thread, while the process runs.
+class AllocTracker {
+public:
+  explicit AllocTracker(std::uint32_t ringCapacity = 1 << 16);
+  ~AllocTracker();
+
+  // fd of the shared memory holding the ring, to be passed to the agent
+  int ringFd() const { return _memory.fd(); }
+
+  struct SizeBucket {
+    std::uint64_t maxSize; // sizes in (maxSize/2, maxSize]
+    std::uint64_t allocations = 0;
+  };
+
+  // blocks still allocated, grouped by the allocating call site
+  struct Leak {
+    std::string function;
+    std::string location;
+    std::uint64_t blocks = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  struct Summary {
+    std::uint64_t allocations = 0;
+    std::uint64_t frees = 0;
+    std::uint64_t allocatedBytes = 0;
+    std::uint64_t liveBytes = 0;
+    std::uint64_t liveBlocks = 0;
+    std::uint64_t peakBytes = 0;
+    // frees of blocks allocated before the agent started
+    std::uint64_t unknownFrees = 0;
+
+    std::vector<SizeBucket> sizes; // only non-empty buckets
+    std::vector<Leak> leaks;       // sorted by bytes, descending
+  };
+
+  // Drains the ring and summarizes events received so far. Blocks still
+  // live when the process has finished are reported as leaks.
+  Summary summarize(const ProcessDebugInfo &debugInfo);
+
+private:
+  struct Block {
+    std::uint64_t size;
+    addr_t callerIp;
+  };
+
+  void drainLoop(std::stop_token stop);
+  // requires _mutex
+  void drain();
+  void onEvent(const AllocEvent &event);
+
+  SharedMemory _memory;
+  AllocRing *_ring;
+
+  std::mutex _mutex; // guards consuming the ring, and the stats below
+  std::unordered_map<addr_t, Block> _liveBlocks;
+  std::uint64_t _allocations = 0;
+  std::uint64_t _frees = 0;
+  std::uint64_t _allocatedBytes = 0;
+  std::uint64_t _liveBytes = 0;
+  std::uint64_t _peakBytes = 0;
+  std::uint64_t _unknownFrees = 0;
+  std::vector<std::uint64_t> _sizeHistogram; // index: log2 of size, rounded up
+
+  std::jthread _drainThread; // last, started when the rest is ready
+};
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,293 @@
+#include "break_condition.hh"
+
+#include <fmt/core.h>
+
+#include <array>
+#include <cctype>
+#include <stdexcept>
+#include <utility>
+
+namespace Whiteboard {
+
+namespace {
+
+// limit of the evaluation stack, checked when compiling
+constexpr std::size_t maxStackDepth = 32;
+
+struct RegisterName {
+  std::string_view name;
+  Registers::Names index;
+};
+
+constexpr RegisterName registerNames[] = {
+    {"rax", Registers::A},   {"rbx", Registers::B},   {"rcx", Registers::C},
+    {"rdx", Registers::D},   {"rsi", Registers::SI},  {"rdi", Registers::DI},
+    {"rsp", Registers::SP},  {"rbp", Registers::BP},  {"r8", Registers::R8},
+    {"r9", Registers::R9},   {"r10", Registers::R10}, {"r11", Registers::R11},
+    {"r12", Registers::R12}, {"r13", Registers::R13}, {"r14", Registers::R14},
+    {"r15", Registers::R15}, {"rip", Registers::IP},
+};
+
+} // namespace
+
+// Recursive descent, emitting the code in postfix order
+class BreakCondition::Parser {
+public:
+  Parser(std::string_view text, std::vector<Instruction> &code)
+      : _text(text), _code(code) {}
+
+  void parse() {
+    parseOr();
+    skipSpaces();
+    if (_pos != _text.size())
+      fail("unexpected '{}'", _text.substr(_pos));
+  }
+
+private:
+  // the right side is jumped over once the left one decides
+  void parseOr() {
+    parseAnd();
+    while (accept("||")) {
+      std::size_t jump = _code.size();
+      emit(Op::JumpIfTrue, -1);
+      parseAnd();
+      emit(Op::Bool, 0);
+      _code[jump].operand = _code.size();
+    }
+  }
+
+  void parseAnd() {
+    parseComparison();
+    while (accept("&&")) {
+      std::size_t jump = _code.size();
+      emit(Op::JumpIfFalse, -1);
+      parseComparison();
+      emit(Op::Bool, 0);
+      _code[jump].operand = _code.size();
+    }
+  }
+
+  void parseComparison() {
+    parseSum();
+    // longer operators first
+    static constexpr std::pair<std::string_view, Op> operators[] = {
+        {"==", Op::Equal},        {"!=", Op::NotEqual}, {"<=", Op::LessEqual},
+        {">=", Op::GreaterEqual}, {"<", Op::Less},      {">", Op::Greater},
+    };
+    for (auto [token, op] : operators) {
+      if (accept(token)) {
+        parseSum();
+        emit(op, -1);
+        return;
+      }
+    }
+  }
+
+  void parseSum() {
+    parseUnary();
+    while (true) {
+      if (accept("+")) {
+        parseUnary();
+        emit(Op::Add, -1);
+      } else if (accept("-")) {
+        parseUnary();
+        emit(Op::Subtract, -1);
+      } else {
+        return;
+      }
+    }
+  }
+
+  void parseUnary() {
+    if (accept("!")) {
+      parseUnary();
+      emit(Op::Not, 0);
+    } else if (accept("-")) {
+      parseUnary();
+      emit(Op::Negate, 0);
+    } else if (accept("*")) {
+      parseUnary();
+      emit(Op::Load, 0);
+    } else {
+      parsePrimary();
+    }
+  }
+
+  void parsePrimary() {
+    skipSpaces();
+    if (accept("(")) {
+      parseOr();
+      if (!accept(")"))
+        fail("missing ')'");
+      return;
+    }
+
+    std::size_t end = _pos;
+    while (end < _text.size() && std::isalnum((unsigned char)_text[end]))
+      ++end;
+    std::string_view word = _text.substr(_pos, end - _pos);
+    if (word.empty())
+      fail("expected a value at '{}'", _text.substr(_pos));
+    _pos = end;
+
+    if (std::isdigit((unsigned char)word[0])) {
+      std::string number(word);
+      std::size_t parsed = 0;
+      std::uint64_t value = 0;
+      try {
+        value = std::stoull(number, &parsed, 0);
+      } catch (const std::out_of_range &) {
+        fail("number out of range '{}'", number);
+      }
+      if (parsed != number.size())
+        fail("invalid number '{}'", number);
+      emit(Op::Constant, 1, value);
+      return;
+    }
+
+    if (word == "hits") {
+      emit(Op::Hits, 1);
+      return;
+    }
+    for (auto [name, index] : registerNames) {
+      if (word == name) {
+        emit(Op::Register, 1, index);
+        return;
+      }
+    }
+    fail("unknown name '{}'", word);
+  }
+
+  void skipSpaces() {
+    while (_pos < _text.size() && std::isspace((unsigned char)_text[_pos]))
+      ++_pos;
+  }
+
+  bool accept(std::string_view token) {
+    skipSpaces();
+    if (!_text.substr(_pos).starts_with(token))
+      return false;
+    _pos += token.size();
+    return true;
+  }
+
+  // `stackEffect`: change of the evaluation stack depth
+  void emit(Op op, int stackEffect, std::int64_t operand = 0) {
+    _code.push_back(Instruction{op, operand});
+    _depth += stackEffect;
+    if (_depth > int(maxStackDepth))
+      fail("expression too complex");
+  }
+
+  template <typename... Args>
+  [[noreturn]] void fail(fmt::format_string<Args...> f, Args &&...args) {
+    throw std::runtime_error(
+        fmt::format("Invalid breakpoint condition '{}': {}", _text,
+                    fmt::format(f, std::forward<Args>(args)...)));
+  }
+
+  std::string_view _text;
+  std::vector<Instruction> &_code;
+  std::size_t _pos = 0;
+  int _depth = 0;
+};
+
+BreakCondition BreakCondition::parse(std::string_view text) {
+  BreakCondition condition;
+  condition._text = text;
+  Parser(condition._text, condition._code).parse();
+  return condition;
+}
+
+std::optional<bool>
+BreakCondition::evaluate(const Registers &registers, std::uint64_t hits,
+                         const ReadMemory &readMemory) const {
+  if (_code.empty())
+    return true;
+
+  std::array<std::int64_t, maxStackDepth> stack;
+  std::size_t top = 0; // number of values on the stack
+
+  auto binary = [&](auto f) {
+    std::int64_t right = stack[--top];
+    stack[top - 1] = f(stack[top - 1], right);
+  };
+
+  for (std::size_t pc = 0; pc < _code.size(); ++pc) {
+    const Instruction &instruction = _code[pc];
+    switch (instruction.op) {
+    case Op::Constant:
+      stack[top++] = instruction.operand;
+      break;
+    case Op::Register:
+      stack[top++] = registers[instruction.operand].get64();
+      break;
+    case Op::Hits:
+      stack[top++] = hits;
+      break;
+    case Op::Load: {
+      auto value = readMemory(stack[top - 1]);
+      if (!value)
+        return std::nullopt;
+      stack[top - 1] = *value;
+      break;
+    }
+    // arithmetic wraps, in unsigned: values read from the process can be
+    // anything, signed overflow would be undefined
+    case Op::Negate:
+      stack[top - 1] = std::int64_t(-std::uint64_t(stack[top - 1]));
+      break;
+    case Op::Not:
+      stack[top - 1] = !stack[top - 1];
+      break;
+    case Op::Add:
+      binary([](std::int64_t a, std::int64_t b) {
+        return std::int64_t(std::uint64_t(a) + std::uint64_t(b));
+      });
+      break;
+    case Op::Subtract:
+      binary([](std::int64_t a, std::int64_t b) {
+        return std::int64_t(std::uint64_t(a) - std::uint64_t(b));
+      });
+      break;
+    case Op::Equal:
+      binary([](std::int64_t a, std::int64_t b) { return a == b; });
+      break;
+    case Op::NotEqual:
+      binary([](std::int64_t a, std::int64_t b) { return a != b; });
+      break;
+    case Op::Less:
+      binary([](std::int64_t a, std::int64_t b) { return a < b; });
+      break;
+    case Op::LessEqual:
+      binary([](std::int64_t a, std::int64_t b) { return a <= b; });
+      break;
+    case Op::Greater:
+      binary([](std::int64_t a, std::int64_t b) { return a > b; });
+      break;
+    case Op::GreaterEqual:
+      binary([](std::int64_t a, std::int64_t b) { return a >= b; });
+      break;
+    case Op::JumpIfFalse:
+      if (stack[top - 1] == 0)
+        pc = instruction.operand - 1;
+      else
+        --top;
+      break;
+    case Op::JumpIfTrue:
+      if (stack[top - 1] != 0) {
+        stack[top - 1] = 1;
+        pc = instruction.operand - 1;
+      } else {
+        --top;
+      }
+      break;
+    case Op::Bool:
+      stack[top - 1] = stack[top - 1] != 0;
+      break;
+    }
+  }
+  return stack[0] != 0;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "registers.hh"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+
+// Condition of a breakpoint, compiled once to a stack-machine bytecode and
+// evaluated by the monitor on each hit.
+//
+// Syntax is C-like, on signed 64-bit values:
+//   registers: rax, rbx, ..., r15, rip
+//   hits: number of times the breakpoint was hit, including this one
+//   *expr: 64-bit word read from the process memory
+//   operators: + - ! == != < <= > >= && || and parentheses
+// for example: "rdi == 3 && *(rsp + 8) > 100 || hits > 1000"
+//
+// && and || evaluate their right side only if needed, as in C: with
+// "rdi != 0 && *rdi == 5", a hit with rdi == 0 reads no memory and is
+// simply false, rather than failing the read.
+class BreakCondition {
+public:
+  // always true
+  BreakCondition() = default;
+
+  // throws std::runtime_error on syntax errors
+  static BreakCondition parse(std::string_view text);
+
+  using ReadMemory = std::function<std::optional<std::uint64_t>(addr_t)>;
+
+  // nullopt if a memory read failed
+  std::optional<bool> evaluate(const Registers &registers, std::uint64_t hits,
+                               const ReadMemory &readMemory) const;
+
+  const std::string &text() const { return _text; }
+
+private:
+  enum class Op : std::uint8_t {
+    Constant, // operand: the value
+    Register, // operand: Registers::Names
+    Hits,
+    Load,
+    Negate,
+    Not,
+    Add,
+    Subtract,
+    Equal,
+    NotEqual,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    // operand: the index jumped to, the value left as the result; else the
+    // value is popped
+    JumpIfFalse,
+    JumpIfTrue,
+    Bool, // 0 or 1
+  };
+
+  struct Instruction {
+    Op op;
+    std::int64_t operand = 0;
+  };
+
+  class Parser;
+
+  std::string _text;
+  std::vector<Instruction> _code;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
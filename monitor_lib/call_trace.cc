@@ -0,0 +1,43 @@
+#include "call_trace.hh"
+
+#include "logging.hh"
+
+namespace Whiteboard {
+
+void CallTrace::onEntry(int tid, const std::string &function, addr_t returnSp,
+                        Clock::time_point time) {
+  auto &thread = _threads[tid];
+  auto &stack = thread.stack;
+
+  auto it = _functions.try_emplace(function).first;
+  ++it->second.calls;
+
+  const std::string &caller =
+      stack.empty() ? std::string(rootName) : *stack.back().function;
+  ++_edges[Edge(caller, function)];
+
+  stack.push_back(Frame{&it->first, returnSp, time});
+  ++thread.active[&it->first];
+}
+
+void CallTrace::onReturn(int tid, addr_t sp, Clock::time_point time) {
+  auto &thread = _threads[tid];
+  auto &stack = thread.stack;
+
+  // Frames are popped up to, and including the one returning here. Frames
+  // deeper than it were left without returning (longjmp, exception), they
+  // are closed at the same time.
+  while (!stack.empty() && stack.back().returnSp <= sp) {
+    const Frame &frame = stack.back();
+    // time of a recursive call is counted when the outermost one returns
+    if (--thread.active[frame.function] == 0)
+      _functions[*frame.function].inclusiveTime += time - frame.entryTime;
+    bool matched = frame.returnSp == sp;
+    stack.pop_back();
+    if (matched)
+      return;
+  }
+  Logging::debug("CallTrace: return at SP=0x{:x} without matching entry", sp);
+}
+
+} // namespace Whiteboard
\ No newline at end of file
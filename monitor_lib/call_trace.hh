@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+
+// Call counts, inclusive times and call-tree edges of traced functions,
+// built from entry/exit events reported by Monitor::traceCalls.
+// Entries are paired with exits per thread, using the stack pointer.
+class CallTrace {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct FunctionStats {
+    std::uint64_t calls = 0;
+    // of the outermost active calls, recursive calls are already included
+    Clock::duration inclusiveTime{0};
+  };
+
+  // caller -> callee; caller is the innermost traced function active on the
+  // thread at the time of the call, or rootName if there is none
+  using Edge = std::pair<std::string, std::string>;
+  static constexpr const char *rootName = "<root>";
+
+  // `returnSp` is the stack pointer value after the function returns
+  void onEntry(int tid, const std::string &function, addr_t returnSp,
+               Clock::time_point time);
+  // `sp` is the stack pointer at the return address
+  void onReturn(int tid, addr_t sp, Clock::time_point time);
+
+  const std::map<std::string, FunctionStats> &functions() const {
+    return _functions;
+  }
+  const std::map<Edge, std::uint64_t> &edges() const { return _edges; }
+
+private:
+  struct Frame {
+    const std::string *function; // key in _functions
+    addr_t returnSp;
+    Clock::time_point entryTime;
+  };
+
+  struct Thread {
+    std::vector<Frame> stack;
+    // number of frames on the stack, per function
+    std::unordered_map<const std::string *, unsigned> active;
+  };
+
+  std::map<std::string, FunctionStats> _functions;
+  std::map<Edge, std::uint64_t> _edges;
+  std::unordered_map<int, Thread> _threads;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
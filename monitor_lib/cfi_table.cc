@@ -0,0 +1,366 @@
+#include "cfi_table.hh"
+
+#include "dwarf_utils.hh"
+#include "logging.hh"
+
+#include <boost/scope_exit.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+namespace {
+
+// DWARF register numbers on x86_64
+constexpr Dwarf_Half dwarfRegBP = 6;
+constexpr Dwarf_Half dwarfRegSP = 7;
+constexpr Dwarf_Half dwarfRegRA = 16;
+
+template <typename T> bool fits(Dwarf_Signed v) {
+  return v >= std::numeric_limits<T>::min() &&
+         v <= std::numeric_limits<T>::max();
+}
+
+// one CFA instruction, with its operand scaled by the alignment factor
+struct Instruction {
+  Dwarf_Small operation = 0;
+  Dwarf_Unsigned reg = 0;
+  Dwarf_Signed value = 0;
+};
+
+std::vector<Instruction> expandInstructions(Dwarf_Cie cie,
+                                            Dwarf_Small *bytes,
+                                            Dwarf_Unsigned length,
+                                            Dwarf_Error &error) {
+  Dwarf_Frame_Instr_Head head = nullptr;
+  Dwarf_Unsigned count = 0;
+  int res = ::dwarf_expand_frame_instructions(cie, bytes, length, &head,
+                                              &count, &error);
+  throwIfDwarfError(res, error, "expanding CFA instructions");
+  if (res != DW_DLV_OK)
+    return {};
+
+  BOOST_SCOPE_EXIT(head) { ::dwarf_dealloc_frame_instr_head(head); }
+  BOOST_SCOPE_EXIT_END
+
+  std::vector<Instruction> instructions;
+  instructions.reserve(count);
+  for (Dwarf_Unsigned i = 0; i < count; ++i) {
+    Dwarf_Unsigned offset = 0;
+    const char *fields = nullptr;
+    Dwarf_Unsigned u[2] = {};
+    Dwarf_Signed s[2] = {};
+    Dwarf_Unsigned codeAlignment = 0;
+    Dwarf_Signed dataAlignment = 0;
+    Dwarf_Block block{};
+    Instruction instruction;
+    res = ::dwarf_get_frame_instruction(
+        head, i, &offset, &instruction.operation, &fields, &u[0], &u[1],
+        &s[0], &s[1], &codeAlignment, &dataAlignment, &block, &error);
+    throwIfDwarfError(res, error, "reading CFA instruction");
+    if (res != DW_DLV_OK)
+      break;
+
+    // fields are described like "rud": register, unsigned operand, times
+    // the data alignment factor
+    int unsignedCount = 0, signedCount = 0;
+    for (const char *field = fields; field && *field; ++field) {
+      switch (*field) {
+      case 'r':
+        instruction.reg = u[unsignedCount++ % 2];
+        break;
+      case 'u':
+        instruction.value = Dwarf_Signed(u[unsignedCount++ % 2]);
+        break;
+      case 's':
+        instruction.value = s[signedCount++ % 2];
+        break;
+      case 'c':
+        instruction.value *= Dwarf_Signed(codeAlignment);
+        break;
+      case 'd':
+        instruction.value *= dataAlignment;
+        break;
+      }
+    }
+    instructions.push_back(instruction);
+  }
+  return instructions;
+}
+
+// the rules kept while executing CFA instructions
+struct FrameState {
+  Dwarf_Unsigned cfaRegister = 0;
+  Dwarf_Signed cfaOffset = 0;
+  bool cfaExpression = false;
+  // offsets from CFA of the saved registers, nullopt if not simply saved
+  std::optional<Dwarf_Signed> raOffset;
+  std::optional<Dwarf_Signed> bpOffset;
+
+  void setRule(Dwarf_Unsigned reg, std::optional<Dwarf_Signed> offset) {
+    if (reg == dwarfRegRA)
+      raOffset = offset;
+    else if (reg == dwarfRegBP)
+      bpOffset = offset;
+  }
+  void restoreRule(Dwarf_Unsigned reg, const FrameState &initial) {
+    if (reg == dwarfRegRA)
+      raOffset = initial.raOffset;
+    else if (reg == dwarfRegBP)
+      bpOffset = initial.bpOffset;
+  }
+
+  CfiTable::Row makeRow(Dwarf_Addr start, Dwarf_Addr end) const {
+    CfiTable::Row row;
+    row.start = start;
+    row.length = end - start;
+    if (!cfaExpression && fits<std::int32_t>(cfaOffset) &&
+        (cfaRegister == dwarfRegSP || cfaRegister == dwarfRegBP)) {
+      row.cfaRegister = cfaRegister == dwarfRegSP
+                            ? CfiTable::CfaRegister::SP
+                            : CfiTable::CfaRegister::BP;
+      row.cfaOffset = cfaOffset;
+    }
+    if (raOffset && fits<std::int16_t>(*raOffset))
+      row.raOffset = *raOffset;
+    if (bpOffset && fits<std::int16_t>(*bpOffset))
+      row.bpOffset = *bpOffset;
+    return row;
+  }
+};
+
+// Executes the instructions from `state`, calling `onRow` with the state
+// before each advance of the location. `initial` is the state after the
+// CIE, for the restore instructions.
+template <typename OnRow>
+void executeInstructions(const std::vector<Instruction> &instructions,
+                         const FrameState &initial, FrameState &state,
+                         Dwarf_Addr &pc, OnRow &&onRow) {
+  std::vector<FrameState> remembered;
+  for (const Instruction &instruction : instructions) {
+    switch (instruction.operation) {
+    case DW_CFA_set_loc:
+      onRow(pc, Dwarf_Addr(instruction.value));
+      pc = instruction.value;
+      break;
+    case DW_CFA_advance_loc:
+    case DW_CFA_advance_loc1:
+    case DW_CFA_advance_loc2:
+    case DW_CFA_advance_loc4:
+      onRow(pc, pc + instruction.value);
+      pc += instruction.value;
+      break;
+    case DW_CFA_def_cfa:
+    case DW_CFA_def_cfa_sf:
+      state.cfaRegister = instruction.reg;
+      state.cfaOffset = instruction.value;
+      state.cfaExpression = false;
+      break;
+    case DW_CFA_def_cfa_register:
+      state.cfaRegister = instruction.reg;
+      break;
+    case DW_CFA_def_cfa_offset:
+    case DW_CFA_def_cfa_offset_sf:
+      state.cfaOffset = instruction.value;
+      break;
+    case DW_CFA_def_cfa_expression:
+      state.cfaExpression = true;
+      break;
+    case DW_CFA_offset:
+    case DW_CFA_offset_extended:
+    case DW_CFA_offset_extended_sf:
+      state.setRule(instruction.reg, instruction.value);
+      break;
+    case DW_CFA_restore:
+    case DW_CFA_restore_extended:
+      state.restoreRule(instruction.reg, initial);
+      break;
+    case DW_CFA_undefined:
+    case DW_CFA_same_value:
+    case DW_CFA_register:
+    case DW_CFA_expression:
+    case DW_CFA_val_offset:
+    case DW_CFA_val_offset_sf:
+    case DW_CFA_val_expression:
+      state.setRule(instruction.reg, std::nullopt);
+      break;
+    case DW_CFA_remember_state:
+      remembered.push_back(state);
+      break;
+    case DW_CFA_restore_state:
+      if (!remembered.empty()) {
+        state = remembered.back();
+        remembered.pop_back();
+      }
+      break;
+    }
+  }
+}
+
+bool sameRules(const CfiTable::Row &a, const CfiTable::Row &b) {
+  return a.cfaRegister == b.cfaRegister && a.cfaOffset == b.cfaOffset &&
+         a.raOffset == b.raOffset && a.bpOffset == b.bpOffset;
+}
+
+} // namespace
+
+CfiTable::CfiTable(const std::string &path) {
+
+  char true_pathbuf[FILENAME_MAX];
+  unsigned tpathlen = FILENAME_MAX;
+  Dwarf_Handler errhand = 0;
+  Dwarf_Ptr errarg = 0;
+  Dwarf_Error error = 0;
+  Dwarf_Debug dbg = 0;
+
+  int res = ::dwarf_init_path(path.c_str(), true_pathbuf, tpathlen,
+                              DW_GROUPNUMBER_ANY, errhand, errarg, &dbg,
+                              &error);
+
+  BOOST_SCOPE_EXIT(dbg, error) {
+    ::dwarf_dealloc_error(dbg, error);
+    ::dwarf_finish(dbg);
+  }
+  BOOST_SCOPE_EXIT_END
+
+  throwIfDwarfError(res, error, "loading CFI from '{}'", path);
+  if (res == DW_DLV_NO_ENTRY) {
+    return;
+  }
+
+  Dwarf_Cie *cies = nullptr;
+  Dwarf_Signed cieCount = 0;
+  Dwarf_Fde *fdes = nullptr;
+  Dwarf_Signed fdeCount = 0;
+
+  res = ::dwarf_get_fde_list_eh(dbg, &cies, &cieCount, &fdes, &fdeCount,
+                                &error);
+  throwIfDwarfError(res, error, "reading .eh_frame of '{}'", path);
+  if (res == DW_DLV_NO_ENTRY) {
+    res = ::dwarf_get_fde_list(dbg, &cies, &cieCount, &fdes, &fdeCount,
+                               &error);
+    throwIfDwarfError(res, error, "reading .debug_frame of '{}'", path);
+  }
+  if (res == DW_DLV_NO_ENTRY) {
+    Logging::debug("CfiTable: no CFI in {}", path);
+    return;
+  }
+
+  BOOST_SCOPE_EXIT(dbg, cies, cieCount, fdes, fdeCount) {
+    ::dwarf_dealloc_fde_cie_list(dbg, cies, cieCount, fdes, fdeCount);
+  }
+  BOOST_SCOPE_EXIT_END
+
+  loadFdes(fdes, fdeCount, error);
+
+  std::ranges::sort(_rows, {}, &Row::start);
+  Logging::debug("CfiTable: loaded {} rows from {} FDEs in {}", _rows.size(),
+                 fdeCount, path);
+}
+
+void CfiTable::loadFdes(Dwarf_Fde *fdes, Dwarf_Signed fdeCount,
+                        Dwarf_Error &error) {
+
+  // the state after the initial instructions, per CIE
+  std::unordered_map<Dwarf_Cie, FrameState> cieStates;
+
+  for (Dwarf_Signed i = 0; i < fdeCount; ++i) {
+    Dwarf_Fde fde = fdes[i];
+
+    Dwarf_Addr lowPc = 0;
+    Dwarf_Unsigned funcLength = 0;
+    Dwarf_Small *fdeBytes = nullptr;
+    Dwarf_Unsigned fdeByteLength = 0;
+    Dwarf_Off cieOffset = 0;
+    Dwarf_Signed cieIndex = 0;
+    Dwarf_Off fdeOffset = 0;
+    int res = ::dwarf_get_fde_range(fde, &lowPc, &funcLength, &fdeBytes,
+                                    &fdeByteLength, &cieOffset, &cieIndex,
+                                    &fdeOffset, &error);
+    throwIfDwarfError(res, error, "reading FDE range");
+    if (res != DW_DLV_OK)
+      continue;
+
+    Dwarf_Cie cie = nullptr;
+    res = ::dwarf_get_cie_of_fde(fde, &cie, &error);
+    throwIfDwarfError(res, error, "reading CIE of FDE");
+    if (res != DW_DLV_OK)
+      continue;
+
+    auto cieState = cieStates.find(cie);
+    if (cieState == cieStates.end()) {
+      Dwarf_Unsigned cieLength = 0;
+      Dwarf_Small version = 0;
+      char *augmenter = nullptr;
+      Dwarf_Unsigned codeAlignment = 0;
+      Dwarf_Signed dataAlignment = 0;
+      Dwarf_Half raRule = 0;
+      Dwarf_Small *initialBytes = nullptr;
+      Dwarf_Unsigned initialLength = 0;
+      Dwarf_Half offsetSize = 0;
+      res = ::dwarf_get_cie_info_b(cie, &cieLength, &version, &augmenter,
+                                   &codeAlignment, &dataAlignment, &raRule,
+                                   &initialBytes, &initialLength, &offsetSize,
+                                   &error);
+      throwIfDwarfError(res, error, "reading CIE");
+      FrameState initial;
+      if (res == DW_DLV_OK) {
+        Dwarf_Addr pc = 0;
+        executeInstructions(
+            expandInstructions(cie, initialBytes, initialLength, error),
+            initial, initial, pc, [](Dwarf_Addr, Dwarf_Addr) {});
+      }
+      cieState = cieStates.emplace(cie, initial).first;
+    }
+
+    Dwarf_Small *instructionBytes = nullptr;
+    Dwarf_Unsigned instructionLength = 0;
+    res = ::dwarf_get_fde_instr_bytes(fde, &instructionBytes,
+                                      &instructionLength, &error);
+    throwIfDwarfError(res, error, "reading FDE instructions");
+    if (res != DW_DLV_OK)
+      continue;
+
+    // the rows of the FDE in one pass, merging adjacent rows with identical
+    // rules
+    const Dwarf_Addr end = lowPc + funcLength;
+    const std::size_t firstRow = _rows.size();
+    auto addRow = [&](const FrameState &state, Dwarf_Addr from,
+                      Dwarf_Addr to) {
+      to = std::min(to, end);
+      if (from < lowPc || from >= to)
+        return;
+      Row row = state.makeRow(from, to);
+      if (_rows.size() > firstRow && sameRules(_rows.back(), row) &&
+          _rows.back().start + _rows.back().length == row.start) {
+        _rows.back().length += row.length;
+      } else {
+        _rows.push_back(row);
+      }
+    };
+
+    FrameState state = cieState->second;
+    Dwarf_Addr pc = lowPc;
+    executeInstructions(
+        expandInstructions(cie, instructionBytes, instructionLength, error),
+        cieState->second, state, pc,
+        [&](Dwarf_Addr from, Dwarf_Addr to) { addRow(state, from, to); });
+    addRow(state, pc, end);
+  }
+}
+
+const CfiTable::Row *CfiTable::findRow(offset_t offset) const {
+  auto it = std::ranges::upper_bound(_rows, offset, {}, &Row::start);
+  if (it == _rows.begin())
+    return nullptr;
+  --it;
+  if (offset >= it->start + it->length)
+    return nullptr;
+  return &*it;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "file_debug_info.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Whiteboard {
+
+// Call frame information of an ELF file (from .eh_frame, or .debug_frame if
+// there is no .eh_frame), precompiled into a sorted table of rows.
+// Only the rules needed to find the caller's frame are kept: CFA, return
+// address and frame pointer.
+class CfiTable {
+public:
+  enum class CfaRegister : std::uint8_t { SP, BP, Unsupported };
+
+  struct Row {
+    offset_t start = 0;
+    std::uint32_t length = 0;
+
+    // CFA = register + cfaOffset
+    std::int32_t cfaOffset = 0;
+    // return address is saved at CFA + raOffset, 0 if undefined (outermost
+    // frame)
+    std::int16_t raOffset = 0;
+    // caller's BP is saved at CFA + bpOffset, 0 if BP is not changed
+    std::int16_t bpOffset = 0;
+    CfaRegister cfaRegister = CfaRegister::Unsupported;
+  };
+
+  CfiTable(const std::string &path);
+
+  // returns row covering the offset, nullptr if not found
+  const Row *findRow(offset_t offset) const;
+
+  std::size_t size() const { return _rows.size(); }
+
+private:
+  void loadFdes(Dwarf_Fde *fdes, Dwarf_Signed fdeCount, Dwarf_Error &error);
+
+  std::vector<Row> _rows; // sorted by start
+};
+
+} // namespace Whiteboard
\ No newline at end of file
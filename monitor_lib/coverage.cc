@@ -0,0 +1,41 @@
+#include "coverage.hh"
+
+#include <fmt/ostream.h>
+
+namespace Whiteboard {
+
+void Coverage::addLine(const SourceLocation &location) {
+  _files[location.file()].try_emplace(location.line(), false);
+}
+
+void Coverage::markCovered(const SourceLocation &location) {
+  _files[location.file()][location.line()] = true;
+}
+
+std::vector<Coverage::FileSummary> Coverage::summarize() const {
+  std::vector<FileSummary> out;
+  for (const auto &[file, lines] : _files) {
+    FileSummary summary{file};
+    for (const auto &[line, covered] : lines) {
+      ++summary.lines;
+      summary.coveredLines += covered;
+    }
+    out.push_back(summary);
+  }
+  return out;
+}
+
+void Coverage::writeLcov(std::ostream &out) const {
+  fmt::print(out, "TN:\n");
+  for (const auto &[file, lines] : _files) {
+    fmt::print(out, "SF:{}\n", file);
+    unsigned covered = 0;
+    for (const auto &[line, isCovered] : lines) {
+      fmt::print(out, "DA:{},{}\n", line, isCovered ? 1 : 0);
+      covered += isCovered;
+    }
+    fmt::print(out, "LH:{}\nLF:{}\nend_of_record\n", covered, lines.size());
+  }
+}
+
+} // namespace Whiteboard
\ No newline at end of file
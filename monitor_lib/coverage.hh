@@ -0,0 +1,36 @@
+#pragma once
+
+#include "source_location.hh"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Whiteboard {
+
+// Line coverage of the executable, collected by Monitor::collectCoverage.
+// Lines are only known as covered or not: each is reported once at most.
+class Coverage {
+public:
+  struct FileSummary {
+    std::string file;
+    unsigned lines = 0;
+    unsigned coveredLines = 0;
+  };
+
+  // a line with code, not covered until marked
+  void addLine(const SourceLocation &location);
+  void markCovered(const SourceLocation &location);
+
+  // per file, sorted by path
+  std::vector<FileSummary> summarize() const;
+  // lcov tracefile, as read by genhtml
+  void writeLcov(std::ostream &out) const;
+
+private:
+  // file -> line -> covered
+  std::map<std::string, std::map<int, bool>> _files;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <libdwarf/dwarf.h>
+#include <libdwarf/libdwarf.h>
+
+#include <fmt/core.h>
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace Whiteboard {
+
+template <typename... Args>
+void throwIfDwarfError(int res, Dwarf_Error &error, std::string_view action_fmt,
+                       const Args &...args) {
+  if (res == DW_DLV_ERROR) {
+    std::string action =
+        fmt::vformat(action_fmt, fmt::make_format_args(args...));
+    std::string error_msg =
+        fmt::format("DWARF error {} : {}", action, dwarf_errmsg(error));
+    throw std::runtime_error(error_msg);
+  }
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include "elf_file.hh"
+
+#include "logging.hh"
+
+#include <boost/scope_exit.hpp>
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <cxxabi.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Whiteboard {
+
+namespace {
+
+std::string demangle(std::string_view name) {
+  std::string mangled(name);
+  int status = 0;
+  char *demangled =
+      abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+  if (status != 0)
+    return mangled; // plain C names
+  std::string out(demangled);
+  std::free(demangled);
+  return out;
+}
+
+} // namespace
+
+ElfFile::ElfFile(const std::string &path) : _path(path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(
+        fmt::format("Failed to open '{}': {}", path, std::strerror(errno)));
+  }
+  BOOST_SCOPE_EXIT(fd) { ::close(fd); }
+  BOOST_SCOPE_EXIT_END
+
+  struct ::stat st;
+  if (::fstat(fd, &st) < 0) {
+    throw std::runtime_error(
+        fmt::format("Failed to stat '{}': {}", path, std::strerror(errno)));
+  }
+  void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error(
+        fmt::format("Failed to map '{}': {}", path, std::strerror(errno)));
+  }
+  _data = static_cast<const std::uint8_t *>(data);
+  _size = st.st_size;
+
+  try {
+    const auto *header = at<::Elf64_Ehdr>(0);
+    if (std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 ||
+        header->e_ident[EI_CLASS] != ELFCLASS64) {
+      throw std::runtime_error(
+          fmt::format("'{}' is not a 64-bit ELF file", path));
+    }
+
+    std::span<const ::Elf64_Shdr> sections(
+        static_cast<const ::Elf64_Shdr *>(
+            at(header->e_shoff, header->e_shnum * sizeof(::Elf64_Shdr))),
+        header->e_shnum);
+    loadSymbols(sections);
+    loadBuildId(sections);
+  } catch (...) {
+    ::munmap(data, _size);
+    throw;
+  }
+
+  Logging::debug("ElfFile: {} function symbols in '{}', build-id {}",
+                 _symbols.size(), path, _buildId.empty() ? "none" : _buildId);
+}
+
+ElfFile::~ElfFile() { ::munmap(const_cast<std::uint8_t *>(_data), _size); }
+
+const void *ElfFile::at(std::uint64_t offset, std::uint64_t size) const {
+  if (offset > _size || size > _size - offset) {
+    throw std::runtime_error(fmt::format(
+        "Failed to read {} bytes at 0x{:x} from '{}'", size, offset, _path));
+  }
+  return _data + offset;
+}
+
+void ElfFile::loadSymbols(std::span<const ::Elf64_Shdr> sections) {
+  // the full symbol table, or just the dynamic one if stripped
+  for (std::uint32_t type : {SHT_SYMTAB, SHT_DYNSYM}) {
+    auto symtab = std::ranges::find(sections, type, &::Elf64_Shdr::sh_type);
+    if (symtab == sections.end() || symtab->sh_link >= sections.size())
+      continue;
+    const ::Elf64_Shdr &strtab = sections[symtab->sh_link];
+
+    std::span<const ::Elf64_Sym> symbols(
+        static_cast<const ::Elf64_Sym *>(
+            at(symtab->sh_offset, symtab->sh_size)),
+        symtab->sh_size / sizeof(::Elf64_Sym));
+    const char *names =
+        static_cast<const char *>(at(strtab.sh_offset, strtab.sh_size));
+
+    for (const ::Elf64_Sym &symbol : symbols) {
+      if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC ||
+          symbol.st_shndx == SHN_UNDEF || symbol.st_shndx >= sections.size() ||
+          symbol.st_name >= strtab.sh_size)
+        continue;
+      std::string_view name(names + symbol.st_name,
+                            ::strnlen(names + symbol.st_name,
+                                      strtab.sh_size - symbol.st_name));
+      // file offset, through the section containing the symbol
+      const ::Elf64_Shdr &section = sections[symbol.st_shndx];
+      offset_t start = symbol.st_value - section.sh_addr + section.sh_offset;
+      _functions.emplace(name, start);
+      _symbols.push_back(Symbol{start, start + symbol.st_size, name});
+    }
+    break;
+  }
+
+  std::ranges::sort(_symbols, {}, &Symbol::start);
+}
+
+void ElfFile::loadBuildId(std::span<const ::Elf64_Shdr> sections) {
+  for (const ::Elf64_Shdr &section : sections) {
+    if (section.sh_type != SHT_NOTE)
+      continue;
+
+    // notes: header, name and description, each 4-byte aligned
+    auto align = [](std::uint64_t n) { return (n + 3) & ~std::uint64_t(3); };
+    std::uint64_t offset = section.sh_offset;
+    std::uint64_t end = section.sh_offset + section.sh_size;
+    while (offset + sizeof(::Elf64_Nhdr) <= end) {
+      const auto *note = at<::Elf64_Nhdr>(offset);
+      std::uint64_t name = offset + sizeof(::Elf64_Nhdr);
+      std::uint64_t desc = name + align(note->n_namesz);
+      offset = desc + align(note->n_descsz);
+      if (offset > end)
+        break;
+
+      if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+          std::memcmp(at(name, 4), "GNU", 4) == 0) {
+        const auto *bytes =
+            static_cast<const std::uint8_t *>(at(desc, note->n_descsz));
+        for (std::uint32_t i = 0; i < note->n_descsz; ++i)
+          _buildId += fmt::format("{:02x}", bytes[i]);
+        return;
+      }
+    }
+  }
+}
+
+std::optional<offset_t> ElfFile::findFunction(const std::string &name) const {
+  auto it = _functions.find(name);
+  if (it == _functions.end())
+    return std::nullopt;
+  return it->second;
+}
+
+std::optional<std::string> ElfFile::findFunctionName(offset_t offset) const {
+  auto it = std::ranges::upper_bound(_symbols, offset, {}, &Symbol::start);
+  if (it == _symbols.begin())
+    return std::nullopt;
+  --it;
+  if (it->end <= offset)
+    return std::nullopt;
+  return demangle(it->name);
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <elf.h>
+
+namespace Whiteboard {
+
+using offset_t = std::uint64_t;
+
+// Function symbols of an ELF file, from its symbol table. Much faster to load
+// than DWARF, but only knows the symbol names, mangled for C++.
+//
+// The file is mapped into memory for the lifetime of the object, the symbol
+// names are not copied out of it.
+class ElfFile {
+public:
+  explicit ElfFile(const std::string &path);
+  ~ElfFile();
+
+  ElfFile(const ElfFile &) = delete;
+  ElfFile &operator=(const ElfFile &) = delete;
+
+  // offset of the function in the file, nullopt if no such symbol
+  std::optional<offset_t> findFunction(const std::string &name) const;
+  // demangled name of the function symbol containing the offset
+  std::optional<std::string> findFunctionName(offset_t offset) const;
+
+  // hex digits of the GNU build-id note, empty if the file has none
+  const std::string &buildId() const { return _buildId; }
+
+private:
+  struct Symbol {
+    // offset range: [start, end)
+    offset_t start = 0;
+    offset_t end = 0;
+
+    std::string_view name;
+  };
+
+  // the mapped range, throws if it's beyond the file
+  const void *at(std::uint64_t offset, std::uint64_t size) const;
+  template <typename T> const T *at(std::uint64_t offset) const {
+    return static_cast<const T *>(at(offset, sizeof(T)));
+  }
+  void loadSymbols(std::span<const ::Elf64_Shdr> sections);
+  void loadBuildId(std::span<const ::Elf64_Shdr> sections);
+
+  std::string _path;
+  const std::uint8_t *_data = nullptr;
+  std::size_t _size = 0;
+
+  std::unordered_map<std::string_view, offset_t> _functions;
+  std::vector<Symbol> _symbols; // sorted by start
+  std::string _buildId;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
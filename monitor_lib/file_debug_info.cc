@@ -1,5 +1,6 @@
 #include "file_debug_info.hh"
 
+#include "dwarf_utils.hh"
 #include "logging.hh"
 
 #include <boost/scope_exit.hpp>
@@ -12,19 +13,113 @@ namespace Whiteboard {
 
 namespace {
 
-template <typename... Args>
-void throwIfDwarfError(int res, Dwarf_Error &error, std::string_view action_fmt,
-                       const Args &...args) {
-  if (res == DW_DLV_ERROR) {
-    std::string action =
-        fmt::vformat(action_fmt, fmt::make_format_args(args...));
-    std::string error_msg =
-        fmt::format("DWARF error {} : {}", action, dwarf_errmsg(error));
-    throw std::runtime_error(error_msg);
+constexpr bool debug_dump = false;
+
+// chains of typedefs, qualifiers and pointers are short, unless broken
+constexpr int maxTypeDepth = 16;
+
+VariableType::Encoding encodingOf(Dwarf_Unsigned encoding) {
+  using Encoding = VariableType::Encoding;
+  switch (encoding) {
+  case DW_ATE_boolean:
+    return Encoding::Bool;
+  case DW_ATE_float:
+    return Encoding::Float;
+  case DW_ATE_signed:
+  case DW_ATE_signed_fixed:
+    return Encoding::Signed;
+  case DW_ATE_unsigned:
+  case DW_ATE_unsigned_fixed:
+  case DW_ATE_UTF:
+  case DW_ATE_address:
+    return Encoding::Unsigned;
+  case DW_ATE_signed_char:
+  case DW_ATE_unsigned_char:
+    return Encoding::Char;
+  default:
+    return Encoding::Other;
   }
 }
 
-constexpr bool debug_dump = false;
+// Compiles the location list or expression of the attribute. A single
+// expression is valid in the whole function, [start, end).
+std::vector<LocationRange> compileLocations(Dwarf_Attribute attr,
+                                            offset_t start, offset_t end,
+                                            Dwarf_Error &error) {
+  Dwarf_Loc_Head_c head = 0;
+  Dwarf_Unsigned count = 0;
+  int res = ::dwarf_get_loclist_c(attr, &head, &count, &error);
+  throwIfDwarfError(res, error, "reading location list");
+  if (res == DW_DLV_NO_ENTRY)
+    return {};
+
+  BOOST_SCOPE_EXIT(head) { ::dwarf_dealloc_loc_head_c(head); }
+  BOOST_SCOPE_EXIT_END;
+
+  std::vector<LocationRange> ranges;
+  for (Dwarf_Unsigned i = 0; i < count; ++i) {
+    Dwarf_Small lle_value = 0;
+    Dwarf_Unsigned raw_low_pc = 0;
+    Dwarf_Unsigned raw_high_pc = 0;
+    Dwarf_Bool debug_addr_unavailable = 0;
+    Dwarf_Addr low_pc = 0;
+    Dwarf_Addr high_pc = 0;
+    Dwarf_Unsigned op_count = 0;
+    Dwarf_Locdesc_c locdesc = 0;
+    Dwarf_Small loclist_source = 0;
+    Dwarf_Unsigned expression_offset = 0;
+    Dwarf_Unsigned locdesc_offset = 0;
+
+    res = ::dwarf_get_locdesc_entry_e(
+        head, i, &lle_value, &raw_low_pc, &raw_high_pc,
+        &debug_addr_unavailable, &low_pc, &high_pc, &op_count, &locdesc,
+        &loclist_source, &expression_offset, &locdesc_offset, &error);
+    throwIfDwarfError(res, error, "reading location entry");
+
+    // base address entries have no operations
+    if (debug_addr_unavailable || op_count == 0)
+      continue;
+
+    LocationRange range{start, end};
+    if (loclist_source != 0) {
+      range.start = low_pc;
+      range.end = high_pc;
+    }
+
+    bool supported = true;
+    for (Dwarf_Unsigned j = 0; j < op_count && supported; ++j) {
+      Dwarf_Small atom = 0;
+      Dwarf_Unsigned op1 = 0;
+      Dwarf_Unsigned op2 = 0;
+      Dwarf_Unsigned op3 = 0;
+      Dwarf_Unsigned branch_offset = 0;
+      res = ::dwarf_get_location_op_value_c(locdesc, j, &atom, &op1, &op2,
+                                            &op3, &branch_offset, &error);
+      throwIfDwarfError(res, error, "reading location operation");
+      supported = range.expression.add(atom, op1, op2);
+    }
+
+    // with unsupported operations, treated as optimized out in the range
+    if (supported && range.start < range.end)
+      ranges.push_back(std::move(range));
+  }
+  return ranges;
+}
+
+std::optional<Dwarf_Unsigned> readUnsigned(Dwarf_Die die, Dwarf_Half attrnum,
+                                           Dwarf_Error &error) {
+  Dwarf_Attribute attr = 0;
+  int res = ::dwarf_attr(die, attrnum, &attr, &error);
+  throwIfDwarfError(res, error, "reading attribute {}", attrnum);
+  if (res == DW_DLV_NO_ENTRY)
+    return std::nullopt;
+
+  Dwarf_Unsigned value = 0;
+  res = ::dwarf_formudata(attr, &value, &error);
+  ::dwarf_dealloc_attribute(attr);
+  throwIfDwarfError(res, error, "reading value of attribute {}", attrnum);
+  return value;
+}
 
 } // namespace
 
@@ -167,21 +262,140 @@ void FileDebugInfo::processDwarfCU(Dwarf_Die &cu_die, const char *die_name,
         lines.back().end = addr;
       }
       lines.push_back(LineInfo{
-          addr, 0, SourceLocation{files[filenum].string(), int(linenum)}});
+          addr, 0, SourceLocation{files[filenum].string(), int(linenum)},
+          bool(begin_statement)});
     }
   } // for lines
 
   _lines.insert(_lines.end(), lines.begin(), lines.end());
 }
 
-void FileDebugInfo::processDwarfDIE(Dwarf_Die &die, Dwarf_Error &error,
-                                    int in_level) {
+void FileDebugInfo::processVariable(Dwarf_Debug dbg, Dwarf_Die &die,
+                                    const char *name, bool isParameter,
+                                    Dwarf_Error &error) {
+  Variable variable{name, readType(dbg, die, error), isParameter};
+  FunctionRange &function = _functionRanges[*_currentFunction];
+
+  Dwarf_Attribute location = 0;
+  int res = ::dwarf_attr(die, DW_AT_location, &location, &error);
+  throwIfDwarfError(res, error, "reading location of {}", name);
+  if (res == DW_DLV_OK) {
+    // in a nested block, it's simplified to the whole function
+    variable.locations =
+        compileLocations(location, function.start, function.end, error);
+    ::dwarf_dealloc_attribute(location);
+  }
+
+  function.variables.push_back(std::move(variable));
+}
+
+const VariableType *FileDebugInfo::readType(Dwarf_Debug dbg, Dwarf_Die &die,
+                                            Dwarf_Error &error, int depth) {
+  Dwarf_Attribute attr = 0;
+  int res = ::dwarf_attr(die, DW_AT_type, &attr, &error);
+  throwIfDwarfError(res, error, "reading type");
+  if (res == DW_DLV_NO_ENTRY)
+    return nullptr;
+
+  Dwarf_Off offset = 0;
+  res = ::dwarf_global_formref(attr, &offset, &error);
+  ::dwarf_dealloc_attribute(attr);
+  if (res != DW_DLV_OK) {
+    // types in .debug_types are referenced by signature, not supported
+    ::dwarf_dealloc_error(dbg, error);
+    error = 0;
+    return nullptr;
+  }
+
+  if (auto it = _typesByOffset.find(offset); it != _typesByOffset.end())
+    return it->second;
+  if (depth == maxTypeDepth)
+    return nullptr;
+
+  Dwarf_Die type_die = 0;
+  res = ::dwarf_offdie_b(dbg, offset, true, &type_die, &error);
+  throwIfDwarfError(res, error, "reading type at 0x{:x}", offset);
+  if (res == DW_DLV_NO_ENTRY)
+    return nullptr;
+
+  BOOST_SCOPE_EXIT(type_die) { ::dwarf_dealloc_die(type_die); }
+  BOOST_SCOPE_EXIT_END;
+
+  Dwarf_Half tag = 0;
+  res = ::dwarf_tag(type_die, &tag, &error);
+  throwIfDwarfError(res, error, "reading tag");
+
+  char *name = nullptr;
+  res = ::dwarf_diename(type_die, &name, &error);
+  throwIfDwarfError(res, error, "reading type name");
+
+  VariableType type{name ? name : ""};
+  type.size = readUnsigned(type_die, DW_AT_byte_size, error).value_or(0);
+
+  switch (tag) {
+  case DW_TAG_base_type:
+    type.encoding = encodingOf(
+        readUnsigned(type_die, DW_AT_encoding, error).value_or(0));
+    break;
+  case DW_TAG_pointer_type:
+  case DW_TAG_reference_type:
+  case DW_TAG_rvalue_reference_type: {
+    const VariableType *target = readType(dbg, type_die, error, depth + 1);
+    type.name = fmt::format("{}{}", target ? target->name : "void",
+                            tag == DW_TAG_pointer_type     ? "*"
+                            : tag == DW_TAG_reference_type ? "&"
+                                                           : "&&");
+    type.size = sizeof(std::uint64_t);
+    type.encoding = VariableType::Encoding::Pointer;
+    break;
+  }
+  case DW_TAG_enumeration_type: {
+    // the underlying type, if given
+    const VariableType *target = readType(dbg, type_die, error, depth + 1);
+    type.encoding = target ? target->encoding : VariableType::Encoding::Signed;
+    break;
+  }
+  case DW_TAG_typedef:
+  case DW_TAG_const_type:
+  case DW_TAG_volatile_type:
+  case DW_TAG_restrict_type:
+  case DW_TAG_atomic_type: {
+    const VariableType *target = readType(dbg, type_die, error, depth + 1);
+    std::string target_name = target ? target->name : "void";
+    if (target) {
+      type.size = target->size;
+      type.encoding = target->encoding;
+    }
+    if (tag == DW_TAG_const_type)
+      type.name = "const " + target_name;
+    else if (tag == DW_TAG_volatile_type)
+      type.name = "volatile " + target_name;
+    else if (tag != DW_TAG_typedef)
+      type.name = target_name;
+    break;
+  }
+  default:
+    // structures, arrays and such are printed as bytes
+    break;
+  }
+
+  const VariableType *out = &_types.emplace_back(std::move(type));
+  _typesByOffset.emplace(offset, out);
+  return out;
+}
+
+void FileDebugInfo::processDwarfDIE(Dwarf_Debug dbg, Dwarf_Die &die,
+                                    Dwarf_Error &error, int in_level) {
 
   // tag
   Dwarf_Half tag = 0;
   int res = ::dwarf_tag(die, &tag, &error);
   throwIfDwarfError(res, error, "reading tag");
 
+  // left the function whose variables are recorded
+  if (in_level <= 1)
+    _currentFunction.reset();
+
   // die name
   char *die_name_ptr = nullptr;
   res = ::dwarf_diename(die, &die_name_ptr, &error);
@@ -204,9 +418,40 @@ void FileDebugInfo::processDwarfDIE(Dwarf_Die &die, Dwarf_Error &error,
         throw std::runtime_error(
             fmt::format("Duplicate function name: {}", die_name_ptr));
       }
+
+      Dwarf_Addr high_pc = 0;
+      Dwarf_Half high_pc_form = 0;
+      Dwarf_Form_Class high_pc_class = DW_FORM_CLASS_UNKNOWN;
+      res = ::dwarf_highpc_b(die, &high_pc, &high_pc_form, &high_pc_class,
+                             &error);
+      throwIfDwarfError(res, error, "reading die high_pc");
+      if (res == DW_DLV_OK) {
+        // DWARF4+ encodes high_pc as offset from low_pc
+        if (high_pc_class == DW_FORM_CLASS_CONSTANT)
+          high_pc += low_pc;
+        _functionRanges.push_back(
+            FunctionRange{low_pc, high_pc, std::string(die_name_ptr)});
+        _currentFunction = _functionRanges.size() - 1;
+
+        Dwarf_Attribute frame_base = 0;
+        res = ::dwarf_attr(die, DW_AT_frame_base, &frame_base, &error);
+        throwIfDwarfError(res, error, "reading frame base");
+        if (res == DW_DLV_OK) {
+          _functionRanges.back().frameBase =
+              compileLocations(frame_base, low_pc, high_pc, error);
+          ::dwarf_dealloc_attribute(frame_base);
+        }
+      }
     }
   }
 
+  // record variables of the function, found in its subtree
+  if ((tag == DW_TAG_variable || tag == DW_TAG_formal_parameter) &&
+      in_level > 1 && _currentFunction) {
+    processVariable(dbg, die, die_name_ptr, tag == DW_TAG_formal_parameter,
+                    error);
+  }
+
   // record compilation unit
   if (tag == DW_TAG_compile_unit) {
     if (die_name_ptr) {
@@ -261,7 +506,7 @@ void FileDebugInfo::walkDwarfDIE(Dwarf_Debug dbg, Dwarf_Die in_die, int is_info,
   Dwarf_Die cur_die = in_die;
   Dwarf_Die child = 0;
 
-  processDwarfDIE(in_die, error, in_level);
+  processDwarfDIE(dbg, in_die, error, in_level);
 
   /*   Loop on a list of siblings */
   for (;;) {
@@ -294,7 +539,7 @@ void FileDebugInfo::walkDwarfDIE(Dwarf_Debug dbg, Dwarf_Die in_die, int is_info,
       cur_die = 0;
     }
     cur_die = sib_die;
-    processDwarfDIE(sib_die, error, in_level);
+    processDwarfDIE(dbg, sib_die, error, in_level);
   }
 }
 
@@ -365,6 +610,10 @@ FileDebugInfo::FileDebugInfo(const std::string &path) {
   }
 
   std::ranges::sort(_lines, {}, &LineInfo::start);
+  std::ranges::sort(_functionRanges, {}, &FunctionRange::start);
+  indexStatements();
+  _typesByOffset.clear();
+  _currentFunction.reset();
 
   for (const auto &line : _lines) {
     Logging::trace("FileDebugInfo: Line - [0x{:<8x}, 0x{:<8x}), {}", line.start,
@@ -374,6 +623,37 @@ FileDebugInfo::FileDebugInfo(const std::string &path) {
 
 FileDebugInfo::~FileDebugInfo() = default;
 
+namespace {
+
+std::uint64_t lineKey(std::uint32_t fileId, int line) {
+  return (std::uint64_t(fileId) << 32) | std::uint32_t(line);
+}
+
+} // namespace
+
+void FileDebugInfo::indexStatements() {
+  std::unordered_map<std::string, std::uint32_t> fileIds;
+  for (const LineInfo &line : _lines) {
+    if (!line.isStatement)
+      continue;
+    const std::string file = line.location.file();
+    auto [it, inserted] = fileIds.try_emplace(file, _files.size());
+    if (inserted) {
+      _files.push_back(file);
+      _filesByName[std::filesystem::path(file).filename().string()].push_back(
+          it->second);
+    }
+
+    // the lines are sorted, so are the offsets; a row may be repeated
+    std::vector<offset_t> &offsets =
+        _statementsByLine[lineKey(it->second, line.location.line())];
+    if (offsets.empty() || offsets.back() != line.start)
+      offsets.push_back(line.start);
+  }
+  Logging::debug("FileDebugInfo: {} lines with statements in {} files",
+                 _statementsByLine.size(), _files.size());
+}
+
 offset_t FileDebugInfo::findFunction(const std::string &fname) const {
   auto it = _functions.find(fname);
   if (it == _functions.end()) {
@@ -382,6 +662,26 @@ offset_t FileDebugInfo::findFunction(const std::string &fname) const {
   return it->second;
 }
 
+std::optional<std::string>
+FileDebugInfo::findFunctionName(offset_t offset) const {
+  const FunctionRange *function = findFunctionRange(offset);
+  if (!function)
+    return std::nullopt;
+  return function->name;
+}
+
+const FileDebugInfo::FunctionRange *
+FileDebugInfo::findFunctionRange(offset_t offset) const {
+  auto it = std::ranges::upper_bound(_functionRanges, offset, {},
+                                     &FunctionRange::start);
+  if (it == _functionRanges.begin())
+    return nullptr;
+  --it;
+  if (it->end <= offset)
+    return nullptr;
+  return &*it;
+}
+
 std::optional<SourceLocation>
 FileDebugInfo::findSourceLocation(offset_t offset) const {
   auto it = std::ranges::lower_bound(_lines, offset, {}, &LineInfo::start);
@@ -395,4 +695,41 @@ FileDebugInfo::findSourceLocation(offset_t offset) const {
   return it->location;
 }
 
+std::vector<std::pair<offset_t, SourceLocation>>
+FileDebugInfo::statements() const {
+  std::vector<std::pair<offset_t, SourceLocation>> out;
+  for (const LineInfo &line : _lines) {
+    if (line.isStatement)
+      out.emplace_back(line.start, line.location);
+  }
+  return out;
+}
+
+std::vector<offset_t> FileDebugInfo::findStatements(const std::string &file,
+                                                    int line) const {
+  std::vector<offset_t> out;
+  // only the files of the same name are compared
+  auto ids =
+      _filesByName.find(std::filesystem::path(file).filename().string());
+  if (ids == _filesByName.end())
+    return out;
+
+  for (std::uint32_t id : ids->second) {
+    const std::string &path = _files[id];
+    bool matches =
+        path == file ||
+        (path.ends_with(file) && path[path.size() - file.size() - 1] == '/');
+    if (!matches)
+      continue;
+    auto it = _statementsByLine.find(lineKey(id, line));
+    if (it != _statementsByLine.end())
+      out.insert(out.end(), it->second.begin(), it->second.end());
+  }
+  // a header included by several units has a file id per path spelling
+  std::ranges::sort(out);
+  auto [first, last] = std::ranges::unique(out);
+  out.erase(first, last);
+  return out;
+}
+
 } // namespace Whiteboard
\ No newline at end of file
@@ -1,16 +1,19 @@
 #pragma once
 
 #include "source_location.hh"
+#include "variables.hh"
 
 #include <libdwarf/dwarf.h>
 #include <libdwarf/libdwarf.h>
 
 #include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace Whiteboard {
@@ -20,11 +23,36 @@ using offset_t = std::uint64_t;
 // Loads DWARF data for ELF executable file
 class FileDebugInfo {
 public:
+  struct FunctionRange {
+    // offset range: [start, end)
+    offset_t start = 0;
+    offset_t end = 0;
+
+    std::string name;
+    // DW_AT_frame_base, the base of DW_OP_fbreg locations
+    std::vector<LocationRange> frameBase;
+    // locals and parameters, including those of nested blocks
+    std::vector<Variable> variables;
+  };
+
   FileDebugInfo(const std::string &path);
   ~FileDebugInfo();
 
   offset_t findFunction(const std::string &fname) const;
+  // name of the function containing the offset
+  std::optional<std::string> findFunctionName(offset_t offset) const;
   std::optional<SourceLocation> findSourceLocation(offset_t offset) const;
+  // the function containing the offset, nullptr if none
+  const FunctionRange *findFunctionRange(offset_t offset) const;
+
+  // rows of the line table marked is_stmt: the beginnings of statements,
+  // where breakpoints are placed for the lines
+  std::vector<std::pair<offset_t, SourceLocation>> statements() const;
+  // Offsets of the statements of the line, sorted, in each file whose path
+  // is `file` or ends with "/" + `file`. Inlined and instantiated code has
+  // many per line. The cost doesn't depend on the size of the line table.
+  std::vector<offset_t> findStatements(const std::string &file,
+                                       int line) const;
 
 private:
   struct LineInfo {
@@ -33,14 +61,24 @@ private:
     offset_t end = 0;
 
     SourceLocation location;
+    bool isStatement = false;
   };
 
-  void processDwarfDIE(Dwarf_Die &die, Dwarf_Error &error, int in_level);
+  void processDwarfDIE(Dwarf_Debug dbg, Dwarf_Die &die, Dwarf_Error &error,
+                       int in_level);
+  void processVariable(Dwarf_Debug dbg, Dwarf_Die &die, const char *name,
+                       bool isParameter, Dwarf_Error &error);
+  // type referenced by DW_AT_type of the DIE, nullptr if it has none
+  const VariableType *readType(Dwarf_Debug dbg, Dwarf_Die &die,
+                               Dwarf_Error &error, int depth = 0);
   void processDwarfCU(Dwarf_Die &cu_die, const char *die_name,
                       Dwarf_Error &error);
   void walkDwarfDIE(Dwarf_Debug dbg, Dwarf_Die in_die, int is_info,
                     int in_level, Dwarf_Error &error);
 
+  // builds the index of the statements by file and line
+  void indexStatements();
+
   std::vector<std::filesystem::path> getDirs(Dwarf_Line_Context line_context,
                                              Dwarf_Error &error) const;
 
@@ -50,6 +88,19 @@ private:
 
   std::unordered_map<std::string, offset_t> _functions;
   std::vector<LineInfo> _lines;
+  std::vector<FunctionRange> _functionRanges; // sorted by start
+  // interned paths of the source files, a file id is the position
+  std::vector<std::string> _files;
+  // ids of the files, by file name
+  std::unordered_map<std::string, std::vector<std::uint32_t>> _filesByName;
+  // offsets of the statements, sorted, by file id in the high 32 bits and
+  // line in the low ones
+  std::unordered_map<std::uint64_t, std::vector<offset_t>> _statementsByLine;
+  // types of the variables, by DIE offset while loading
+  std::deque<VariableType> _types;
+  std::unordered_map<Dwarf_Off, const VariableType *> _typesByOffset;
+  // index of the function whose children are walked, while loading
+  std::optional<std::size_t> _currentFunction;
 };
 
 } // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "location_expression.hh"
+
+#include <libdwarf/dwarf.h>
+
+#include <array>
+
+namespace Whiteboard {
+
+namespace {
+
+// limit of the evaluation stack, checked when compiling
+constexpr std::size_t maxStackDepth = 16;
+
+// DWARF register numbers of x86_64, up to the return address column
+constexpr std::array<Registers::Names, 17> dwarfRegisters = {
+    Registers::A,   Registers::D,   Registers::C,   Registers::B,
+    Registers::SI,  Registers::DI,  Registers::BP,  Registers::SP,
+    Registers::R8,  Registers::R9,  Registers::R10, Registers::R11,
+    Registers::R12, Registers::R13, Registers::R14, Registers::R15,
+    Registers::IP,
+};
+
+std::optional<Registers::Names> fromDwarfRegister(std::uint64_t number) {
+  if (number >= dwarfRegisters.size())
+    return std::nullopt; // vector registers and such
+  return dwarfRegisters[number];
+}
+
+} // namespace
+
+bool LocationExpression::add(std::uint8_t atom, std::uint64_t op1,
+                             std::uint64_t op2) {
+  // nothing may follow a complete location
+  if (!_code.empty() && (_code.back().op == Op::Register ||
+                         _code.back().op == Op::StackValue))
+    return false;
+
+  std::optional<Registers::Names> reg;
+  if (atom >= DW_OP_reg0 && atom <= DW_OP_reg31)
+    reg = fromDwarfRegister(atom - DW_OP_reg0);
+  else if (atom >= DW_OP_breg0 && atom <= DW_OP_breg31)
+    reg = fromDwarfRegister(atom - DW_OP_breg0);
+  else if (atom == DW_OP_regx || atom == DW_OP_bregx)
+    reg = fromDwarfRegister(op1);
+
+  if (atom >= DW_OP_lit0 && atom <= DW_OP_lit31)
+    return push(Op::Constant, atom - DW_OP_lit0);
+  if ((atom >= DW_OP_reg0 && atom <= DW_OP_reg31) || atom == DW_OP_regx) {
+    // a variable in a register has no other location
+    if (!reg || !_code.empty())
+      return false;
+    _code.push_back(Instruction{Op::Register, std::uint8_t(*reg)});
+    return true;
+  }
+  if (atom >= DW_OP_breg0 && atom <= DW_OP_breg31)
+    return reg && push(Op::RegisterBase, std::int64_t(op1), *reg);
+
+  switch (atom) {
+  case DW_OP_addr:
+    return push(Op::Address, std::int64_t(op1));
+  // libdwarf sign-extends the signed forms already
+  case DW_OP_const1u:
+  case DW_OP_const1s:
+  case DW_OP_const2u:
+  case DW_OP_const2s:
+  case DW_OP_const4u:
+  case DW_OP_const4s:
+  case DW_OP_const8u:
+  case DW_OP_const8s:
+  case DW_OP_constu:
+  case DW_OP_consts:
+    return push(Op::Constant, std::int64_t(op1));
+  case DW_OP_bregx:
+    return reg && push(Op::RegisterBase, std::int64_t(op2), *reg);
+  case DW_OP_fbreg:
+    return push(Op::FrameBase, std::int64_t(op1));
+  case DW_OP_call_frame_cfa:
+    return push(Op::Cfa);
+  case DW_OP_plus_uconst:
+    return apply(Op::PlusConstant, 1, std::int64_t(op1));
+  case DW_OP_plus:
+    return apply(Op::Add, 2);
+  case DW_OP_minus:
+    return apply(Op::Subtract, 2);
+  case DW_OP_stack_value:
+    return apply(Op::StackValue, 1);
+  default:
+    return false;
+  }
+}
+
+bool LocationExpression::push(Op op, std::int64_t operand, std::uint8_t reg) {
+  if (_depth == maxStackDepth)
+    return false;
+  _code.push_back(Instruction{op, reg, operand});
+  ++_depth;
+  return true;
+}
+
+bool LocationExpression::apply(Op op, std::size_t operands,
+                               std::int64_t operand) {
+  if (_depth < operands)
+    return false;
+  _code.push_back(Instruction{op, 0, operand});
+  _depth -= operands - 1;
+  return true;
+}
+
+std::optional<LocationExpression::Location>
+LocationExpression::evaluate(const Context &context) const {
+  if (_code.empty())
+    return std::nullopt;
+
+  std::array<std::uint64_t, maxStackDepth> stack;
+  std::size_t top = 0; // number of values on the stack
+
+  for (const Instruction &instruction : _code) {
+    switch (instruction.op) {
+    case Op::Constant:
+      stack[top++] = instruction.operand;
+      break;
+    case Op::Address:
+      stack[top++] = instruction.operand + context.loadBias;
+      break;
+    case Op::Register:
+      return Location{Location::Kind::Register, instruction.reg};
+    case Op::RegisterBase:
+      stack[top++] =
+          context.registers[instruction.reg].get64() + instruction.operand;
+      break;
+    case Op::FrameBase:
+      if (!context.frameBase)
+        return std::nullopt;
+      stack[top++] = *context.frameBase + instruction.operand;
+      break;
+    case Op::Cfa:
+      if (!context.cfa)
+        return std::nullopt;
+      stack[top++] = *context.cfa;
+      break;
+    case Op::PlusConstant:
+      stack[top - 1] += instruction.operand;
+      break;
+    case Op::Add:
+      --top;
+      stack[top - 1] += stack[top];
+      break;
+    case Op::Subtract:
+      --top;
+      stack[top - 1] -= stack[top];
+      break;
+    case Op::StackValue:
+      return Location{Location::Kind::Value, stack[top - 1]};
+    }
+  }
+
+  return Location{Location::Kind::Memory, stack[top - 1]};
+}
+
+} // namespace Whiteboard
\ No newline at end of file
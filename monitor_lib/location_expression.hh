@@ -0,0 +1,78 @@
+#pragma once
+
+#include "registers.hh"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+
+// DWARF location expression of a variable, compiled once to a compact
+// bytecode and evaluated at each stop without libdwarf.
+//
+// Supports the operations compilers emit for variables in memory, in
+// registers and for computed values. Operations reading process memory
+// (DW_OP_deref and such) are not supported: a location is computed from the
+// registers alone, so the values of all variables can be read in one go.
+class LocationExpression {
+public:
+  struct Location {
+    enum class Kind {
+      Memory,   // value: the address
+      Register, // value: Registers::Names
+      Value,    // value: the value itself
+    };
+    Kind kind;
+    std::uint64_t value;
+  };
+
+  struct Context {
+    const Registers &registers;
+    // DW_AT_frame_base of the function, for DW_OP_fbreg
+    std::optional<addr_t> frameBase;
+    // canonical frame address of the function's frame
+    std::optional<addr_t> cfa;
+    // added to addresses of DW_OP_addr, for position independent code
+    addr_t loadBias = 0;
+  };
+
+  // Appends an operation, as decoded by libdwarf. Returns false if it's not
+  // supported, which makes the whole expression unusable.
+  bool add(std::uint8_t atom, std::uint64_t op1, std::uint64_t op2);
+
+  // nullopt if the expression needs the frame base or CFA, and it's not known
+  std::optional<Location> evaluate(const Context &context) const;
+
+private:
+  enum class Op : std::uint8_t {
+    Constant,     // operand: the value
+    Address,      // operand: the address in the file
+    Register,     // reg: the register holding the variable
+    RegisterBase, // reg + operand
+    FrameBase,    // frame base + operand
+    Cfa,
+    PlusConstant, // operand: added to the top
+    Add,
+    Subtract,
+    StackValue,
+  };
+
+  struct Instruction {
+    Op op;
+    std::uint8_t reg = 0; // Registers::Names
+    std::int64_t operand = 0;
+  };
+
+  // appends an operation pushing a value
+  bool push(Op op, std::int64_t operand = 0, std::uint8_t reg = 0);
+  // appends an operation taking `operands` values and pushing the result
+  bool apply(Op op, std::size_t operands, std::int64_t operand = 0);
+
+  std::vector<Instruction> _code;
+  std::size_t _depth = 0; // of the stack after the code
+};
+
+} // namespace Whiteboard
\ No newline at end of file
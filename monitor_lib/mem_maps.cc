@@ -3,6 +3,7 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <fstream>
 #include <regex>
 
@@ -10,7 +11,8 @@ namespace Whiteboard {
 
 MemMaps::Mapping MemMaps::parseLine(const std::string &line) {
   static const std::regex RX(
-      "^([0-9a-f]+)-([0-9a-f]+) .{4} ([0-9a-f]+) [0-9:]{5} [0-9]+\\s*(.*)$");
+      "^([0-9a-f]+)-([0-9a-f]+) ([-r][-w][-x][ps]) ([0-9a-f]+) "
+      "[0-9a-f]+:[0-9a-f]+ [0-9]+\\s*(.*)$");
 
   std::smatch match;
   if (!std::regex_match(line, match, RX))
@@ -19,11 +21,12 @@ MemMaps::Mapping MemMaps::parseLine(const std::string &line) {
   MemMaps::Mapping out;
   out.low = std::stoull(match[1], nullptr, 16);
   out.high = std::stoull(match[2], nullptr, 16);
-  out.offset = std::stoull(match[3], nullptr, 16);
-  out.path = match[4];
+  out.perms = match[3];
+  out.offset = std::stoull(match[4], nullptr, 16);
+  out.path = match[5];
 
-  Logging::trace("MemMaps: parsed mapping: {}-{} {} {}", out.low, out.high,
-                 out.offset, out.path);
+  Logging::trace("MemMaps: parsed mapping: {}-{} {} {} {}", out.low, out.high,
+                 out.perms, out.offset, out.path);
 
   return out;
 }
@@ -73,14 +76,23 @@ MemMaps::findFileAndOffsetByAddress(std::uint64_t addr) const {
 
 std::optional<std::tuple<std::string, uint64_t>>
 MemMaps::tryFindFileAndOffsetByAddress(std::uint64_t addr) const noexcept {
-  for (const Mapping &mapping : _mappings) {
-    if (addr >= mapping.low && addr < mapping.high) {
-      auto offset = mapping.offset + (addr - mapping.low);
-      return std::make_tuple(mapping.path, offset);
-    }
-  }
+  const Mapping *mapping = findMapping(addr);
+  if (!mapping)
+    return std::nullopt;
+
+  auto offset = mapping->offset + (addr - mapping->low);
+  return std::make_tuple(mapping->path, offset);
+}
 
-  return std::nullopt;
+const MemMaps::Mapping *
+MemMaps::findMapping(std::uint64_t addr) const noexcept {
+  auto it = std::ranges::upper_bound(_mappings, addr, {}, &Mapping::low);
+  if (it == _mappings.begin())
+    return nullptr;
+  --it;
+  if (addr >= it->high)
+    return nullptr;
+  return &*it;
 }
 
 } // namespace Whiteboard
\ No newline at end of file
@@ -10,8 +10,23 @@ namespace Whiteboard {
 // Loads and keeps data from /proc/PID/maps
 class MemMaps {
 public:
+  struct Mapping {
+    std::uint64_t low, high, offset;
+    std::string path;
+    std::string perms; // like "rw-p"
+
+    bool readable() const { return perms[0] == 'r'; }
+    bool writable() const { return perms[1] == 'w'; }
+    bool shared() const { return perms[3] == 's'; }
+  };
+
   void load(int pid);
 
+  const std::vector<Mapping> &mappings() const { return _mappings; }
+
+  // Returns mapping containing the process-space address, nullptr if none
+  const Mapping *findMapping(std::uint64_t addr) const noexcept;
+
   // returns address, in process space, of a byte mapped from file at offset
   std::uint64_t findAddressByOffset(const std::string &path,
                                     std::uint64_t offset) const;
@@ -27,14 +42,9 @@ public:
   tryFindFileAndOffsetByAddress(std::uint64_t addr) const noexcept;
 
 private:
-  struct Mapping {
-    std::uint64_t low, high, offset;
-    std::string path;
-  };
-
   static Mapping parseLine(const std::string &line);
 
-  std::vector<Mapping> _mappings;
+  std::vector<Mapping> _mappings; // sorted by address, as in the file
 };
 
 } // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "memory_cache.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/uio.h>
+
+namespace Whiteboard {
+
+namespace {
+
+bool isCacheable(const MemMaps::Mapping *mapping) {
+  // mappings not known yet are read directly, to be safe
+  return mapping && !(mapping->shared() && mapping->writable());
+}
+
+::ssize_t readDirect(int pid, std::uint64_t addr, std::span<std::uint8_t> out) {
+  ::iovec local{out.data(), out.size()};
+  ::iovec remote{(void *)addr, out.size()};
+  return ::process_vm_readv(pid, &local, 1, &remote, 1, 0);
+}
+
+} // namespace
+
+std::size_t MemoryCache::read(int pid, std::uint64_t addr,
+                              std::span<std::uint8_t> out,
+                              const MemMaps &maps) {
+  ++_stats.reads;
+
+  std::size_t done = 0;
+  while (done < out.size()) {
+    std::uint64_t at = addr + done;
+    std::uint64_t pageAddr = at & ~std::uint64_t(pageSize - 1);
+    std::size_t len = std::min(out.size() - done, pageSize - (at - pageAddr));
+
+    if (isCacheable(maps.findMapping(at))) {
+      const std::uint8_t *data = page(pid, pageAddr);
+      if (!data)
+        break;
+      std::memcpy(out.data() + done, data + (at - pageAddr), len);
+      done += len;
+    } else {
+      ++_stats.uncachedReads;
+      ::ssize_t res = readDirect(pid, at, out.subspan(done, len));
+      if (res <= 0)
+        break;
+      _stats.bytesRead += res;
+      done += res;
+      if (std::size_t(res) < len)
+        break;
+    }
+  }
+  return done;
+}
+
+void MemoryCache::write(std::uint64_t addr,
+                        std::span<const std::uint8_t> data) {
+  std::size_t done = 0;
+  while (done < data.size()) {
+    std::uint64_t at = addr + done;
+    std::uint64_t pageAddr = at & ~std::uint64_t(pageSize - 1);
+    std::size_t len = std::min(data.size() - done, pageSize - (at - pageAddr));
+    if (auto it = _pages.find(pageAddr); it != _pages.end())
+      std::memcpy(it->second.data() + (at - pageAddr), data.data() + done, len);
+    done += len;
+  }
+}
+
+void MemoryCache::invalidate() {
+  if (_pages.empty())
+    return;
+  _pages.clear();
+  ++_stats.invalidations;
+}
+
+const std::uint8_t *MemoryCache::page(int pid, std::uint64_t page) {
+  auto [it, inserted] = _pages.try_emplace(page);
+  if (!inserted) {
+    ++_stats.pageHits;
+    return it->second.data();
+  }
+
+  ++_stats.pageMisses;
+  it->second.resize(pageSize);
+  if (readDirect(pid, page, it->second) != pageSize) {
+    _pages.erase(it);
+    return nullptr;
+  }
+  _stats.bytesRead += pageSize;
+  return it->second.data();
+}
+
+} // namespace Whiteboard
\ No newline at end of file
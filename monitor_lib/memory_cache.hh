@@ -0,0 +1,48 @@
+#pragma once
+
+#include "mem_maps.hh"
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+// Copies of memory pages of a stopped process, each read whole on the first
+// access, so that repeated small reads cost one syscall per page. Valid only
+// until the process runs again: the owner invalidates it on each resume, and
+// writes its own modifications through it. Pages of shared writable mappings,
+// which other processes may change any time, are never cached.
+class MemoryCache {
+public:
+  static constexpr std::size_t pageSize = 4096;
+
+  struct Stats {
+    std::uint64_t reads = 0;
+    std::uint64_t pageHits = 0;
+    std::uint64_t pageMisses = 0; // pages read from the process
+    std::uint64_t uncachedReads = 0;
+    std::uint64_t invalidations = 0;
+    std::uint64_t bytesRead = 0; // from the process
+  };
+
+  // Reads memory of the process into `out`. Returns the number of bytes read,
+  // less than requested if an unreadable page is reached.
+  std::size_t read(int pid, std::uint64_t addr, std::span<std::uint8_t> out,
+                   const MemMaps &maps);
+  // updates the cached copies after the memory was written
+  void write(std::uint64_t addr, std::span<const std::uint8_t> data);
+  void invalidate();
+
+  const Stats &stats() const { return _stats; }
+
+private:
+  // the cached page, read if needed; nullptr if it can't be read
+  const std::uint8_t *page(int pid, std::uint64_t page);
+
+  std::unordered_map<std::uint64_t, std::vector<std::uint8_t>> _pages;
+  Stats _stats;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
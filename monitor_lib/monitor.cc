@@ -1,28 +1,171 @@
 #include "monitor.hh"
 
 #include "logging.hh"
+#include "x86_decoder.hh"
 
 #include <fmt/core.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/scope_exit.hpp>
 
 #include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <utility>
 
 #include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 namespace Whiteboard {
 
-Monitor Monitor::runExecutable(const std::string &executable,
-                               const Args &args) {
+namespace {
+
+// seccomp filter making the listed syscalls trap to the tracer
+std::vector<::sock_filter>
+makeSeccompFilter(const std::vector<long> &syscalls) {
+  std::vector<::sock_filter> filter = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(::seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(::seccomp_data, nr)),
+  };
+  for (long nr : syscalls) {
+    filter.push_back(
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, std::uint32_t(nr), 0, 1));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+  }
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+  return filter;
+}
+
+// options of all traced processes, and `extra` ones
+void setTracingOptions(int pid, long extra = 0) {
+  long options = PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD |
+                 PTRACE_O_EXITKILL | extra;
+  if (::ptrace(PTRACE_SETOPTIONS, pid, nullptr, (void *)options)) {
+    throw std::runtime_error(fmt::format("Unable to set ptrace options: {}",
+                                         std::strerror(errno)));
+  }
+}
+
+// options of the processes followed into their children
+constexpr long followOptions =
+    PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC;
+
+// Takes the child from its initial SIGSTOP to the stop after exec
+void startTracing(int pid) {
+  int wstatus;
+  ::waitpid(pid, &wstatus, 0);
+  if (!WIFSTOPPED(wstatus) || WSTOPSIG(wstatus) != SIGSTOP) {
+    throw std::runtime_error(
+        fmt::format("Unexpected initial state of the child: {}", wstatus));
+  }
+
+  setTracingOptions(pid);
+
+  // the filter may trace execve itself, its seccomp stops are passed over
+  do {
+    ::ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+    ::waitpid(pid, &wstatus, 0);
+    if (!WIFSTOPPED(wstatus) || WSTOPSIG(wstatus) != SIGTRAP) {
+      ::kill(pid, SIGKILL);
+      throw std::runtime_error(
+          fmt::format("Failed to start the child: {}", wstatus));
+    }
+  } while (wstatus >> 16 == PTRACE_EVENT_SECCOMP);
+}
+
+// environment of the monitor, with the agent preloaded and told about the ring
+std::vector<std::string> makeAgentEnvironment(int ringFd) {
+  std::string preload = fmt::format("LD_PRELOAD={}", WHITEBOARD_ALLOC_AGENT);
+  std::vector<std::string> environment;
+  for (char **variable = environ; *variable; ++variable) {
+    std::string_view v = *variable;
+    if (v.starts_with("LD_PRELOAD="))
+      preload += fmt::format(":{}", v.substr(v.find('=') + 1));
+    else
+      environment.emplace_back(v);
+  }
+  environment.push_back(std::move(preload));
+  environment.push_back(fmt::format("{}={}", allocRingFdVariable, ringFd));
+  return environment;
+}
+
+// larger variables are read in part, enough to print them
+constexpr std::size_t maxVariableRead = 4096;
+constexpr std::size_t maxIovecs = 1024; // IOV_MAX
+
+} // namespace
+
+const char *Monitor::stopReasonName(StopReason reason) {
+  switch (reason) {
+  case StopReason::Breakpoint:
+    return "breakpoint";
+  case StopReason::Syscall:
+    return "syscall";
+  case StopReason::Finished:
+    return "finished";
+  case StopReason::Other:
+    return "other";
+  case StopReason::Watchpoint:
+    return "watchpoint";
+  case StopReason::Fork:
+    return "fork";
+  case StopReason::Exec:
+    return "exec";
+  }
+  return "?";
+}
+
+Monitor Monitor::runExecutable(const std::string &executable, const Args &args,
+                               const RunOptions &options) {
 
   Logging::debug("running {}", executable);
 
+  // everything is prepared before fork, so that the child does not allocate
+  std::vector<const char *> argv;
+  argv.reserve(args.size() + 1);
+
+  for (auto &arg : args)
+    argv.push_back(arg.c_str());
+  argv.push_back(nullptr);
+
+  std::vector<::sock_filter> filter;
+  if (!options.tracedSyscalls.empty())
+    filter = makeSeccompFilter(options.tracedSyscalls);
+  ::sock_fprog filterProgram{(unsigned short)filter.size(), filter.data()};
+
+  std::unique_ptr<AllocTracker> allocTracker;
+  std::vector<std::string> environment;
+  std::vector<const char *> envp;
+  if (options.trackAllocations) {
+    allocTracker = std::make_unique<AllocTracker>();
+    environment = makeAgentEnvironment(allocTracker->ringFd());
+    for (auto &variable : environment)
+      envp.push_back(variable.c_str());
+    envp.push_back(nullptr);
+  }
+
+  std::string path =
+      boost::filesystem::canonical(boost::filesystem::path(executable))
+          .native();
+
   int pid = ::fork();
   if (pid == 0) {
 
@@ -31,137 +174,1925 @@ Monitor Monitor::runExecutable(const std::string &executable,
       std::abort();
     }
 
-    std::vector<const char *> argv;
-    argv.reserve(args.size() + 1);
+    // let the tracer set the options before the filter can trigger
+    ::raise(SIGSTOP);
 
-    for (auto &arg : args)
-      argv.push_back(arg.c_str());
-    argv.push_back(nullptr);
+    if (!filter.empty()) {
+      if (::prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) ||
+          ::prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &filterProgram)) {
+        std::perror("Failed to install seccomp filter");
+        std::abort();
+      }
+    }
 
-    ::execv(executable.c_str(), const_cast<char **>(argv.data()));
+    if (allocTracker) {
+      // inherited by the agent
+      ::fcntl(allocTracker->ringFd(), F_SETFD, 0);
+      ::execve(executable.c_str(), const_cast<char **>(argv.data()),
+               const_cast<char **>(envp.data()));
+    } else {
+      ::execv(executable.c_str(), const_cast<char **>(argv.data()));
+    }
     std::perror("Failed ot execute target");
     std::abort();
   }
 
-  return Monitor(pid, executable);
+  // DWARF is loaded while the process starts
+  auto debugInfo = ProcessDebugInfo::loadAsync(path);
+  startTracing(pid);
+  long tracingOptions = options.followChildren ? followOptions : 0;
+  if (tracingOptions)
+    setTracingOptions(pid, tracingOptions);
+  return Monitor(pid, path, std::move(debugInfo), std::move(allocTracker),
+                 tracingOptions, options.tracedSyscalls);
+}
+
+Monitor Monitor::attachChild(const ChildProcess &child) {
+  // seized rather than attached, not to send another SIGSTOP
+  if (::ptrace(PTRACE_SEIZE, child.pid, nullptr, nullptr)) {
+    throw std::runtime_error(fmt::format("Unable to attach to process {}: {}",
+                                         child.pid, std::strerror(errno)));
+  }
+  int wstatus;
+  ::waitpid(child.pid, &wstatus, __WALL);
+  if (!WIFSTOPPED(wstatus)) {
+    throw std::runtime_error(
+        fmt::format("Process {} finished before attaching", child.pid));
+  }
+  setTracingOptions(child.pid, followOptions);
+
+  std::string path =
+      std::filesystem::read_symlink(fmt::format("/proc/{}/exe", child.pid));
+  Logging::debug("Monitor: attached to process {} running {}", child.pid,
+                 path);
+  return Monitor(child, path);
 }
 
-Monitor::Monitor(int pid, const std::string &executable)
-    : _executable(
-          boost::filesystem::canonical(boost::filesystem::path(executable))
-              .native()),
-      _debugInfo(pid, _executable) {
+Monitor::Monitor(int pid, const std::string &executable,
+                 ProcessDebugInfo::FileDebugInfoFuture debugInfo,
+                 std::unique_ptr<AllocTracker> allocTracker,
+                 long tracingOptions, std::vector<long> tracedSyscalls)
+    : _executable(executable), _tracingOptions(tracingOptions),
+      _tracedSyscalls(std::move(tracedSyscalls)),
+      _debugInfo(pid, _executable, std::move(debugInfo)),
+      _allocTracker(std::move(allocTracker)) {
 
   _childPid = pid;
   _running = true;
-  wait();
+
+  ::user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+  _recentState.registers = Registers::fromLinux(regs);
 }
 
-Monitor::~Monitor() = default;
+Monitor::Monitor(const ChildProcess &child, const std::string &executable)
+    : Monitor(child.pid, executable, ProcessDebugInfo::loadAsync(executable),
+              nullptr, followOptions, child.tracedSyscalls) {
+  for (const FunctionBreakpoint &bp : child.breakpoints) {
+    _breakpointFunctions.emplace(bp.id, bp.function);
+    setFunctionBreakpoint(bp.id, bp.function);
+    if (bp.condition) {
+      _breakpointFilters[bp.id] =
+          BreakpointFilter{*bp.condition, bp.ignoreCount, 0};
+    }
+  }
+}
+
+Monitor::~Monitor() {
+  for (const auto &[id, checkpoint] : _checkpoints)
+    killProcess(checkpoint.pid);
+}
 
 Monitor::StopState Monitor::wait() {
   assert(_running);
 
+  while (true) {
+    int wstatus;
+    {
+      ScopedLatency latency(_stats.phase(MonitorStats::Phase::Wait));
+      ::waitpid(_childPid, &wstatus, 0);
+    }
+
+    // a late interrupt, requested when the process was already stopping for
+    // another reason. Swallow it and repeat the last request.
+    while (isInterruptStop(wstatus)) {
+      _interruptRequested = false;
+      resume(_lastResumeRequest);
+      ScopedLatency latency(_stats.phase(MonitorStats::Phase::Wait));
+      ::waitpid(_childPid, &wstatus, 0);
+    }
+
+    if (auto state = processStop(wstatus))
+      return *state;
+
+    // an uninteresting breakpoint hit, carry on as requested
+    __ptrace_request request = _lastResumeRequest;
+    if (auto state = leaveBreakpoint())
+      return *state;
+    resume(request);
+  }
+}
+
+std::optional<Monitor::StopState> Monitor::processStop(int wstatus) {
+
   StopState state;
 
-  int wstatus;
-  ::waitpid(_childPid, &wstatus, 0);
   if (!WIFSTOPPED(wstatus)) {
     Logging::debug("Monitor: child finished: {}", wstatus);
     _running = false;
+    reapRestoredProcess();
     state.reason = StopReason::Finished;
   } else {
 
     // read registers
     ::user_regs_struct regs;
-    ::ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+    {
+      ScopedLatency latency(_stats.phase(MonitorStats::Phase::GetRegisters));
+      ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+    }
     Logging::trace("Monitor: stopped, RIP=0x{:x}", regs.rip);
 
-    auto it =
-        std::find_if(_breakpoints.begin(), _breakpoints.end(),
-                     [&](auto &bptr) { return bptr.addr == regs.rip - 1; });
-    if (it != _breakpoints.end()) {
-      Logging::debug("Monitor: breakpoint hit, id={}", it->id);
-      state.reason = StopReason::Breakpoint;
-      state.breakpoint = it->id;
+    if (wstatus >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8))) {
+      // for the caller, or only for the watched pages it writes
+      bool traced = std::ranges::find(_tracedSyscalls, long(regs.orig_rax)) !=
+                    _tracedSyscalls.end();
+      std::optional<WatchedSyscall> watched =
+          std::exchange(_watchedSyscall, std::nullopt);
+      if (!watched) {
+        std::vector<addr_t> pages = watchedPagesWritten(regs);
+        if (!pages.empty() && restartWithPagesWritable(regs, pages))
+          return std::nullopt;
+        if (!traced)
+          return std::nullopt;
+      }
 
-      disarmBreakpoint(*it);
-      _breakpoints.erase(it);
+      __ptrace_request request = _lastResumeRequest;
+      state.reason = StopReason::Syscall;
+      state.syscall = completeSyscall(regs, state.child);
+      if (watched && _running) {
+        protectPages(_childPid, watched->pages, _watchedPages, false);
+        for (const WatchedBytes &bytes : watched->before) {
+          std::vector<std::uint8_t> after =
+              readMemory(bytes.addr, bytes.data.size());
+          auto [changed, unchanged] = std::ranges::mismatch(after, bytes.data);
+          if (changed == after.end())
+            continue;
+          state.reason = StopReason::Watchpoint;
+          state.watchpoint = bytes.id;
+          state.address = bytes.addr + (changed - after.begin());
+          Logging::debug("Monitor: watchpoint {} hit, {} wrote to 0x{:x}",
+                         bytes.id, syscallName(state.syscall->number),
+                         state.address);
+          break;
+        }
+      }
+      if (state.reason == StopReason::Syscall && !traced) {
+        // done, carry on as requested before the stop
+        _lastResumeRequest = request;
+        return std::nullopt;
+      }
+      ++_stats.stops[std::size_t(state.reason)];
+      return state;
+    }
+
+    int event = wstatus >> 16;
+    if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK) {
+      unsigned long child = 0;
+      ptrace(PTRACE_GETEVENTMSG, _childPid, 0, &child);
+      _recentState.registers = Registers::fromLinux(regs);
+      state.child = detachChild(int(child), event == PTRACE_EVENT_VFORK);
+      if (!state.child)
+        return std::nullopt;
+      state.reason = StopReason::Fork;
+      ++_stats.stops[std::size_t(state.reason)];
+      return state;
+    }
+    if (event == PTRACE_EVENT_EXEC) {
+      reloadExecutable();
+      _recentState.registers = Registers::fromLinux(regs);
+      state.reason = StopReason::Exec;
+      ++_stats.stops[std::size_t(state.reason)];
+      return state;
+    }
+
+    int signal = WSTOPSIG(wstatus);
+    bool breakpointTrap = signal == SIGTRAP;
+    if (breakpointTrap && _lastResumeRequest == PTRACE_SINGLESTEP) {
+      // after a single-step, the IP may follow a breakpoint that was not hit
+      ::siginfo_t info{};
+      ptrace(PTRACE_GETSIGINFO, _childPid, 0, &info);
+      breakpointTrap = info.si_code == SI_KERNEL;
+    }
+
+    std::uint64_t lookupStart = __rdtsc();
+    auto site = _breakpoints.find(regs.rip - 1);
+    bool breakpointHit = breakpointTrap && site != _breakpoints.end();
+    std::optional<Breakpoint> hit;
+    if (breakpointHit) {
       regs.rip -= 1;
-      ::ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
-    } else {
-      state.reason = StopReason::Other;
+      _recentState.registers = Registers::fromLinux(regs);
+
+      // the first of the breakpoints at the address which stops is reported
+      for (const Breakpoint &bp : site->second.breakpoints) {
+        if (filterBreakpointHit(bp.id, _recentState.registers)) {
+          hit = bp;
+          break;
+        }
+      }
     }
+    _stats.phase(MonitorStats::Phase::BreakpointLookup)
+        .record(__rdtsc() - lookupStart);
+
+    if (breakpointHit) {
+      ++_stats.breakpointHits;
+      ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+      if (!hit) {
+        ++_stats.filteredHits;
+        return std::nullopt;
+      }
+
+      Logging::debug("Monitor: breakpoint hit, id={}", hit->id);
+      state.reason = StopReason::Breakpoint;
+      state.breakpoint = hit->id;
+
+      if (!hit->persistent)
+        removeBreakpoint(regs.rip, hit->id);
+      ++_stats.stops[std::size_t(state.reason)];
+      return state;
+    }
+
+    if (signal == SIGSEGV && !_watchedPages.empty()) {
+      ::siginfo_t info{};
+      ptrace(PTRACE_GETSIGINFO, _childPid, 0, &info);
+      addr_t addr = addr_t(info.si_addr);
+      auto page = _watchedPages.find(addr & ~addr_t(MemoryCache::pageSize - 1));
+      if (info.si_code == SEGV_ACCERR && page != _watchedPages.end()) {
+        // a write faulting in a displaced copy is done at the original
+        for (const DisplacedStepSlot &slot : _displacedStepSlots) {
+          if (slot.instruction != 0 && regs.rip == slot.addr) {
+            regs.rip = slot.instruction;
+            ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+          }
+        }
+        _recentState.registers = Registers::fromLinux(regs);
+        _watchFaultPage = page->first;
+
+        auto region = std::ranges::find_if(
+            _watchedRegions, [&](const WatchedRegion &region) {
+              return addr >= region.addr && addr - region.addr < region.len;
+            });
+        if (region == _watchedRegions.end())
+          return std::nullopt;
+
+        Logging::debug("Monitor: watchpoint {} hit, write to 0x{:x} at 0x{:x}",
+                       region->id, addr, regs.rip);
+        state.reason = StopReason::Watchpoint;
+        state.watchpoint = region->id;
+        state.address = addr;
+        ++_stats.stops[std::size_t(state.reason)];
+        return state;
+      }
+    }
+
+    state.reason = StopReason::Other;
+    state.signal = signal;
+    // SIGTRAP is ours (single-step, exec, int3), anything else is forwarded
+    if (signal != SIGTRAP)
+      _pendingSignal = signal;
 
     // store registers
     _recentState.registers = Registers::fromLinux(regs);
   }
+  ++_stats.stops[std::size_t(state.reason)];
+  return state;
+}
+
+SyscallInfo Monitor::completeSyscall(const ::user_regs_struct &entryRegs,
+                                     std::optional<ChildProcess> &child) {
+  SyscallInfo info;
+  info.number = entryRegs.orig_rax;
+  info.args = {entryRegs.rdi, entryRegs.rsi, entryRegs.rdx,
+               entryRegs.r10, entryRegs.r8,  entryRegs.r9};
+
+  // run to the syscall-exit-stop, to get the result
+  while (true) {
+    resume(PTRACE_SYSCALL);
+    int wstatus;
+    ::waitpid(_childPid, &wstatus, 0);
+
+    if (!WIFSTOPPED(wstatus)) {
+      // exit/exit_group, or killed
+      Logging::debug("Monitor: child finished in syscall: {}", wstatus);
+      _running = false;
+      reapRestoredProcess();
+      return info;
+    }
+
+    int event = wstatus >> 16;
+    if (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK) {
+      unsigned long pid = 0;
+      ptrace(PTRACE_GETEVENTMSG, _childPid, 0, &pid);
+      child = detachChild(int(pid), event == PTRACE_EVENT_VFORK);
+      continue;
+    }
+    if (event == PTRACE_EVENT_EXEC) {
+      reloadExecutable();
+      continue;
+    }
+
+    ::user_regs_struct regs;
+    ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+    _recentState.registers = Registers::fromLinux(regs);
+
+    int signal = WSTOPSIG(wstatus);
+    if (signal == (SIGTRAP | 0x80)) {
+      info.result = regs.rax;
+      Logging::debug("Monitor: syscall {}", info);
+      return info;
+    }
+
+    // a signal arrived during the syscall, it's delivered when resuming
+    if (signal != SIGTRAP && !isInterruptStop(wstatus))
+      _pendingSignal = signal;
+    if (isInterruptStop(wstatus))
+      _interruptRequested = false;
+  }
+}
+
+void Monitor::resume(__ptrace_request request) {
+  _memoryCache.invalidate();
+  {
+    ScopedLatency latency(_stats.phase(MonitorStats::Phase::Resume));
+    ptrace(request, _childPid, nullptr, (void *)(long)_pendingSignal);
+  }
+  _pendingSignal = 0;
+  _lastResumeRequest = request;
+}
+
+void Monitor::interrupt() {
+  _interruptRequested = true;
+  ::kill(_childPid, SIGSTOP);
+}
+
+bool Monitor::isInterruptStop(int wstatus) const {
+  return _interruptRequested && WIFSTOPPED(wstatus) &&
+         WSTOPSIG(wstatus) == SIGSTOP;
+}
+
+std::optional<Monitor::StopState> Monitor::stepOverBreakpoint() {
+  if (_watchFaultPage)
+    return stepOverWatchFault();
+
+  addr_t ip = _recentState.registers[Registers::IP].get64();
+  auto it = _breakpoints.find(ip);
+  if (it == _breakpoints.end())
+    return std::nullopt;
+
+  Logging::trace("Monitor: stepping over breakpoint at 0x{:x}", ip);
+  if (auto state = stepDisplaced(ip))
+    return state;
+
+  // the trap is out while stepping, the process may miss it if it comes back
+  // at once, through a signal handler
+  disarmBreakpoint(ip, it->second);
+  resume(PTRACE_SINGLESTEP);
+  StopState state = wait();
+  if (_running)
+    armBreakpoint(ip);
+  return state;
+}
+
+std::optional<Monitor::StopState>
+Monitor::stepDisplaced(addr_t addr) {
+  // the original code, without the traps of the breakpoints in it
+  std::vector<std::uint8_t> code;
+  try {
+    code = readMemory(addr, maxInstructionLength);
+  } catch (const std::runtime_error &) {
+    return std::nullopt;
+  }
+  for (std::size_t i = 0; i < code.size(); ++i) {
+    if (auto other = _breakpoints.find(addr + i); other != _breakpoints.end())
+      code[i] = other->second.originalByte;
+  }
+
+  // branches depend on their address, they are done by the monitor
+  if (auto branch = decodeBranch(code))
+    return emulateBranch(addr, *branch);
+
+  // a signal handler would return to the copy
+  if (_pendingSignal != 0)
+    return std::nullopt;
+
+  addr_t slot = 0;
+  std::size_t length = 0;
+  try {
+    slot = displacedStepSlot(addr);
+    auto moved = relocateInstructions(code, addr, slot, 1);
+    length = moved.size();
+    assert(length <= maxInstructionLength);
+    auto it = std::ranges::find(_displacedStepSlots, slot,
+                                &DisplacedStepSlot::addr);
+    if (it->instruction != addr) {
+      writeMemory(slot, moved);
+      it->instruction = addr;
+    }
+  } catch (const std::runtime_error &e) {
+    Logging::trace("Monitor: no displaced step at 0x{:x}: {}", addr,
+                   e.what());
+    return std::nullopt;
+  }
+
+  ::user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+  regs.rip = slot;
+  ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+
+  resume(PTRACE_SINGLESTEP);
+  StopState state = wait();
+  if (!_running)
+    return state;
+
+  // back to the original code: after the instruction, or at it if the step
+  // was interrupted before it completed
+  ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+  if (regs.rip >= slot && regs.rip <= slot + length) {
+    regs.rip = addr + (regs.rip - slot);
+    ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+  }
+  _recentState.registers = Registers::fromLinux(regs);
+  return state;
+}
+
+std::optional<Monitor::StopState>
+Monitor::emulateBranch(addr_t addr, const Branch &branch) {
+  ::user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+  // by their number in the encoding
+  unsigned long long *gprs[] = {&regs.rax, &regs.rcx, &regs.rdx, &regs.rbx,
+                                &regs.rsp, &regs.rbp, &regs.rsi, &regs.rdi,
+                                &regs.r8,  &regs.r9,  &regs.r10, &regs.r11,
+                                &regs.r12, &regs.r13, &regs.r14, &regs.r15};
+  auto readWord = [&](addr_t a) -> std::optional<std::uint64_t> {
+    errno = 0;
+    long data = ptrace(PTRACE_PEEKDATA, _childPid, (void *)a, nullptr);
+    if (errno != 0)
+      return std::nullopt;
+    return data;
+  };
+
+  constexpr std::uint64_t zeroFlag = 1 << 6;
+  using Condition = Branch::Condition;
+  bool taken = true;
+  switch (branch.condition) {
+  case Condition::Always:
+    break;
+  case Condition::Flags:
+    taken = conditionHolds(branch.conditionCode, regs.eflags);
+    break;
+  case Condition::RcxZero:
+    taken = regs.rcx == 0;
+    break;
+  case Condition::Loop:
+  case Condition::LoopZero:
+  case Condition::LoopNotZero:
+    taken = --regs.rcx != 0;
+    if (branch.condition == Condition::LoopZero)
+      taken = taken && (regs.eflags & zeroFlag);
+    if (branch.condition == Condition::LoopNotZero)
+      taken = taken && !(regs.eflags & zeroFlag);
+    break;
+  }
+
+  // the target, with the registers as before the branch
+  addr_t next = addr + branch.length;
+  addr_t target = next;
+  if (taken && branch.kind == Branch::Kind::Return) {
+    auto returnAddress = readWord(regs.rsp);
+    if (!returnAddress)
+      return std::nullopt;
+    target = *returnAddress;
+    regs.rsp += 8 + branch.popBytes;
+  } else if (taken && branch.target == Branch::Target::Relative) {
+    target = next + branch.displacement;
+  } else if (taken && branch.target == Branch::Target::Register) {
+    target = *gprs[branch.reg];
+  } else if (taken) {
+    addr_t operand = branch.displacement;
+    if (branch.ripRelative)
+      operand += next;
+    if (branch.reg >= 0)
+      operand += *gprs[branch.reg];
+    if (branch.index >= 0)
+      operand += *gprs[branch.index] * branch.scale;
+    auto value = readWord(operand);
+    if (!value)
+      return std::nullopt;
+    target = *value;
+  }
+
+  if (taken && branch.kind == Branch::Kind::Call) {
+    Word64 returnAddress(next);
+    try {
+      writeMemory(regs.rsp - 8, std::span(returnAddress.bytes(), 8));
+    } catch (const std::runtime_error &) {
+      return std::nullopt;
+    }
+    regs.rsp -= 8;
+  }
+  regs.rip = target;
+  ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+  _recentState.registers = Registers::fromLinux(regs);
+  Logging::trace("Monitor: emulated branch at 0x{:x} to 0x{:x}", addr,
+                 target);
+
+  // as after a single-step
+  StopState state;
+  state.reason = StopReason::Other;
+  state.signal = SIGTRAP;
   return state;
 }
 
+addr_t Monitor::displacedStepSlot(addr_t addr) {
+  // as for trampolines, leaves room for RIP-relative operands
+  constexpr addr_t maxDistance = 1ull << 30;
+
+  auto it = std::ranges::find_if(
+      _displacedStepSlots, [&](const DisplacedStepSlot &slot) {
+        return std::max(slot.addr, addr) - std::min(slot.addr, addr) <
+               maxDistance;
+      });
+  if (it != _displacedStepSlots.end())
+    return it->addr;
+
+  // a slot holds a single instruction, relocated with the same length
+  addr_t slot = allocateTrampoline(addr, maxInstructionLength);
+  _displacedStepSlots.push_back(DisplacedStepSlot{slot});
+  return slot;
+}
+
+std::optional<Monitor::StopState> Monitor::stepOverWatchFault() {
+  addr_t page = *std::exchange(_watchFaultPage, std::nullopt);
+  Logging::trace("Monitor: stepping over write to watched page 0x{:x}", page);
+  protectPages(_childPid, {&page, 1}, _watchedPages, true);
+
+  // the instruction may be at a breakpoint, when faulting in a displaced copy
+  std::optional<StopState> state = stepOverBreakpoint();
+  if (!state) {
+    resume(PTRACE_SINGLESTEP);
+    state = wait();
+  }
+  if (_running && _watchedPages.contains(page))
+    protectPages(_childPid, {&page, 1}, _watchedPages, false);
+  return state;
+}
+
+void Monitor::installWatchFilter() {
+  if (_watchFilterInstalled)
+    return;
+
+  // the program is passed on the stack of the process, below the red zone
+  std::vector<::sock_filter> filter =
+      makeSeccompFilter(memoryWritingSyscalls());
+  std::size_t filterSize = filter.size() * sizeof(::sock_filter);
+  addr_t sp = _recentState.registers[Registers::SP].get64();
+  addr_t filterAddr = (sp - 128 - filterSize) & ~addr_t(15);
+  addr_t programAddr = filterAddr - sizeof(::sock_fprog);
+  ::sock_fprog program{(unsigned short)filter.size(),
+                       reinterpret_cast<::sock_filter *>(filterAddr)};
+  writeMemory(filterAddr,
+              std::span(reinterpret_cast<const std::uint8_t *>(filter.data()),
+                        filterSize));
+  writeMemory(programAddr,
+              std::span(reinterpret_cast<const std::uint8_t *>(&program),
+                        sizeof(program)));
+
+  long res = injectSyscall(SYS_prctl, {PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0});
+  if (res == 0) {
+    res = injectSyscall(SYS_seccomp,
+                        {SECCOMP_SET_MODE_FILTER, 0, programAddr});
+  }
+  if (res < 0) {
+    throw std::runtime_error(fmt::format(
+        "Failed to install seccomp filter in the process: {}",
+        std::strerror(-res)));
+  }
+  _watchFilterInstalled = true;
+}
+
+bool Monitor::restartWithPagesWritable(::user_regs_struct regs,
+                                       std::span<const addr_t> pages) {
+  // only the syscall instruction is known to be made again 2 bytes back
+  addr_t ip = regs.rip - 2;
+  errno = 0;
+  Word64 code(ptrace(PTRACE_PEEKTEXT, _childPid, (void *)ip, nullptr));
+  if (errno != 0 || code.get8(0) != 0x0f || code.get8(1) != 0x05)
+    return false;
+
+  constexpr addr_t pageSize = MemoryCache::pageSize;
+  WatchedSyscall watched{{pages.begin(), pages.end()}, {}};
+  for (const WatchedRegion &region : _watchedRegions) {
+    for (addr_t page : pages) {
+      addr_t start = std::max(region.addr, page);
+      addr_t end = std::min(region.addr + region.len, page + pageSize);
+      if (start < end) {
+        watched.before.push_back(
+            {region.id, start, readMemory(start, end - start)});
+      }
+    }
+  }
+
+  // Nothing can be injected in the middle of the syscall: it's skipped, to
+  // its exit, where mprotect is injected before making it again.
+  ::user_regs_struct skipped = regs;
+  skipped.orig_rax = -1;
+  ptrace(PTRACE_SETREGS, _childPid, 0, &skipped);
+  ptrace(PTRACE_SYSCALL, _childPid, nullptr, nullptr);
+  int wstatus;
+  ::waitpid(_childPid, &wstatus, 0);
+  if (!WIFSTOPPED(wstatus) || WSTOPSIG(wstatus) != (SIGTRAP | 0x80)) {
+    throw std::runtime_error(
+        fmt::format("Unexpected stop skipping a syscall: {}", wstatus));
+  }
+  protectPages(_childPid, pages, _watchedPages, true);
+
+  Logging::trace("Monitor: {} made again with watched pages writable",
+                 syscallName(regs.orig_rax));
+  regs.rax = regs.orig_rax;
+  regs.orig_rax = -1;
+  regs.rip = ip;
+  ptrace(PTRACE_SETREGS, _childPid, 0, &regs);
+  _watchedSyscall = std::move(watched);
+  return true;
+}
+
+std::vector<addr_t>
+Monitor::watchedPagesWritten(const ::user_regs_struct &regs) {
+  constexpr addr_t pageSize = MemoryCache::pageSize;
+  std::vector<addr_t> pages;
+  if (_watchedPages.empty())
+    return pages;
+
+  SyscallInfo info;
+  info.number = regs.orig_rax;
+  info.args = {regs.rdi, regs.rsi, regs.rdx, regs.r10, regs.r8, regs.r9};
+  auto readWord = [&](std::uint64_t addr) -> std::optional<std::uint64_t> {
+    errno = 0;
+    long data = ptrace(PTRACE_PEEKDATA, _childPid, (void *)addr, nullptr);
+    if (errno != 0)
+      return std::nullopt;
+    return data;
+  };
+  std::vector<SyscallOutput> outputs = syscallOutputs(info, readWord);
+  // lengths come from the process, the ends may wrap around
+  auto overlaps = [&](addr_t page, const SyscallOutput &output) {
+    return output.len > 0 && output.addr < page + pageSize &&
+           (output.addr >= page || page - output.addr < output.len);
+  };
+  for (auto [page, protection] : _watchedPages) {
+    if (std::ranges::any_of(outputs, [&](const SyscallOutput &output) {
+          return overlaps(page, output);
+        }))
+      pages.push_back(page);
+  }
+  std::ranges::sort(pages);
+  return pages;
+}
+
+void Monitor::protectPages(int pid, std::span<const addr_t> pages,
+                           const std::unordered_map<addr_t, int> &protections,
+                           bool writable) {
+  constexpr addr_t pageSize = MemoryCache::pageSize;
+  std::size_t i = 0;
+  while (i < pages.size()) {
+    int protection = protections.at(pages[i]);
+    std::size_t j = i + 1;
+    while (j < pages.size() && pages[j] == pages[j - 1] + pageSize &&
+           protections.at(pages[j]) == protection)
+      ++j;
+    if (!writable)
+      protection &= ~PROT_WRITE;
+
+    long res = injectSyscall(pid, SYS_mprotect,
+                             {pages[i], (j - i) * pageSize,
+                              std::uint64_t(protection)});
+    if (res < 0) {
+      throw std::runtime_error(
+          fmt::format("Unable to protect memory at 0x{:x}: {}", pages[i],
+                      std::strerror(-res)));
+    }
+    i = j;
+  }
+}
+
+std::optional<Monitor::StopState> Monitor::leaveBreakpoint() {
+  auto state = stepOverBreakpoint();
+  if (state &&
+      (state->reason != StopReason::Other || state->signal != SIGTRAP))
+    return state;
+  return std::nullopt;
+}
+
+bool Monitor::filterBreakpointHit(breakpoint_id bid,
+                                  const Registers &registers) {
+  auto it = _breakpointFilters.find(bid);
+  if (it == _breakpointFilters.end())
+    return true;
+
+  BreakpointFilter &filter = it->second;
+  ++filter.hits;
+  if (filter.ignoreCount > 0) {
+    --filter.ignoreCount;
+    return false;
+  }
+
+  auto readMemory = [&](addr_t addr) -> std::optional<std::uint64_t> {
+    errno = 0;
+    long data = ptrace(PTRACE_PEEKDATA, _childPid, (void *)addr, nullptr);
+    if (errno != 0)
+      return std::nullopt;
+    return data;
+  };
+  auto result = filter.condition.evaluate(registers, filter.hits, readMemory);
+  if (!result) {
+    // better to stop than to miss the hit
+    Logging::error("Monitor: failed to read memory for condition '{}'",
+                   filter.condition.text());
+    return true;
+  }
+  Logging::trace("Monitor: breakpoint {} condition: {}", bid, *result);
+  return *result;
+}
+
 Monitor::StopState Monitor::stepi() {
   assert(_running);
-  ::ptrace(PTRACE_SINGLESTEP, _childPid, nullptr, nullptr);
+  if (auto state = stepOverBreakpoint())
+    return *state;
+  resume(PTRACE_SINGLESTEP);
   return wait();
 }
 
 Monitor::StopState Monitor::cont() {
   assert(_running);
-  ::ptrace(PTRACE_CONT, _childPid, nullptr, nullptr);
+  // anything other than the single-step trap ends the cont()
+  if (auto state = leaveBreakpoint())
+    return *state;
+  resume(PTRACE_CONT);
   return wait();
 }
 
+Monitor::StopState Monitor::sample(std::chrono::microseconds interval,
+                                   Profile &profile) {
+  assert(_running);
+  using Clock = std::chrono::steady_clock;
+
+  // SIGCHLD is blocked, so that it can be awaited with a timeout. This lets
+  // the loop notice a stop of the process without waiting for the next tick.
+  sigset_t sigchld;
+  ::sigemptyset(&sigchld);
+  ::sigaddset(&sigchld, SIGCHLD);
+  sigset_t oldMask;
+  ::pthread_sigmask(SIG_BLOCK, &sigchld, &oldMask);
+  BOOST_SCOPE_EXIT(&oldMask) {
+    ::pthread_sigmask(SIG_SETMASK, &oldMask, nullptr);
+  }
+  BOOST_SCOPE_EXIT_END
+
+  if (auto state = leaveBreakpoint())
+    return *state;
+
+  while (true) {
+    resume(PTRACE_CONT);
+    auto deadline = Clock::now() + interval;
+
+    int wstatus = 0;
+    while (::waitpid(_childPid, &wstatus, WNOHANG) == 0) {
+      auto now = Clock::now();
+      if (now >= deadline) {
+        interrupt();
+        ::waitpid(_childPid, &wstatus, 0);
+        break;
+      }
+      auto timeout =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+      ::timespec ts{};
+      ts.tv_sec = timeout.count() / 1'000'000'000;
+      ts.tv_nsec = timeout.count() % 1'000'000'000;
+      ::sigtimedwait(&sigchld, nullptr, &ts);
+    }
+
+    if (!isInterruptStop(wstatus)) {
+      if (auto state = processStop(wstatus))
+        return *state;
+      if (auto state = leaveBreakpoint())
+        return *state;
+      continue;
+    }
+
+    _interruptRequested = false;
+    ::user_regs_struct regs;
+    ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+    profile.addSample(regs.rip, regs.rsp);
+  }
+}
+
+Monitor::StopState Monitor::traceCalls(CallTrace &trace) {
+  assert(_running);
+
+  while (true) {
+    StopState state = cont();
+    if (state.reason != StopReason::Breakpoint)
+      return state;
+
+    if (auto it = _tracedFunctions.find(state.breakpoint);
+        it != _tracedFunctions.end()) {
+      onCallEntry(it->second, trace);
+      continue;
+    }
+
+    addr_t ip = _recentState.registers[Registers::IP].get64();
+    if (auto it = _returnBreakpoints.find(ip);
+        it != _returnBreakpoints.end() && it->second.id == state.breakpoint) {
+      onCallReturn(it, trace);
+      continue;
+    }
+
+    return state;
+  }
+}
+
+Monitor::StopState Monitor::collectCoverage(Coverage &coverage) {
+  assert(_running);
+
+  if (!_coverageArmed) {
+    // one breakpoint per address, for all the lines starting there, all
+    // added at once
+    auto statements = _debugInfo.executableStatements();
+    std::unordered_map<addr_t, breakpoint_id> byAddress;
+    byAddress.reserve(statements.size());
+    std::vector<std::pair<addr_t, breakpoint_id>> bps;
+    for (auto &[addr, location] : statements) {
+      coverage.addLine(location);
+      auto [it, inserted] = byAddress.try_emplace(addr);
+      if (inserted) {
+        it->second = _nextInternalBreakpointId++;
+        bps.emplace_back(addr, it->second);
+      }
+      _coverageBreakpoints[it->second].push_back(std::move(location));
+    }
+    addBreakpoints(bps);
+    _coverageArmed = true;
+    Logging::debug("Monitor: coverage breakpoints at {} addresses",
+                   byAddress.size());
+  }
+
+  while (true) {
+    StopState state = cont();
+    if (state.reason != StopReason::Breakpoint)
+      return state;
+
+    auto it = _coverageBreakpoints.find(state.breakpoint);
+    if (it == _coverageBreakpoints.end())
+      return state;
+    for (const SourceLocation &location : it->second)
+      coverage.markCovered(location);
+    _coverageBreakpoints.erase(it);
+  }
+}
+
+void Monitor::onCallEntry(const std::string &function, CallTrace &trace) {
+  auto now = CallTrace::Clock::now();
+
+  // at the entry, SP points at the return address
+  addr_t sp = _recentState.registers[Registers::SP].get64();
+  errno = 0;
+  addr_t returnAddress =
+      ptrace(PTRACE_PEEKDATA, _childPid, (void *)sp, nullptr);
+  if (errno != 0) {
+    throw std::runtime_error(
+        fmt::format("Unable to read return address of {} (PEEKDATA): {}",
+                    function, std::strerror(errno)));
+  }
+
+  Logging::trace("Monitor: entered {}, return address=0x{:x}", function,
+                 returnAddress);
+  trace.onEntry(_childPid, function, sp + sizeof(addr_t), now);
+
+  auto [it, inserted] = _returnBreakpoints.try_emplace(returnAddress);
+  if (inserted) {
+    it->second.id = _nextInternalBreakpointId++;
+    addBreakpoint(returnAddress, it->second.id, true);
+  }
+  ++it->second.activeCalls;
+}
+
+void Monitor::onCallReturn(
+    std::unordered_map<addr_t, ReturnBreakpoint>::iterator it,
+    CallTrace &trace) {
+  auto now = CallTrace::Clock::now();
+
+  addr_t sp = _recentState.registers[Registers::SP].get64();
+  trace.onReturn(_childPid, sp, now);
+
+  // the return breakpoint is removed when no call is returning there anymore
+  if (--it->second.activeCalls == 0) {
+    removeBreakpoint(it->first, it->second.id);
+    _returnBreakpoints.erase(it);
+  }
+}
+
 void Monitor::breakAtFunction(const std::string &fname, breakpoint_id bid) {
   addr_t addr = _debugInfo.findFunction(fname);
-  addBreakpoint(addr, bid);
+  addBreakpoint(addr, bid, true);
+  _breakpointFunctions.emplace(bid, fname);
+}
+
+void Monitor::breakAtLine(const std::string &file, int line,
+                          breakpoint_id bid) {
+  std::vector<addr_t> addrs = _debugInfo.findLineAddresses(file, line);
+  if (addrs.empty()) {
+    throw std::runtime_error(
+        fmt::format("No statements at {}:{}", file, line));
+  }
+  std::vector<std::pair<addr_t, breakpoint_id>> bps;
+  bps.reserve(addrs.size());
+  for (addr_t addr : addrs)
+    bps.emplace_back(addr, bid);
+  addBreakpoints(bps, true);
+  Logging::debug("Monitor: breakpoint {} at {}:{}, {} locations", bid, file,
+                 line, addrs.size());
+}
+
+void Monitor::setFunctionBreakpoint(breakpoint_id bid,
+                                    const std::string &function) {
+  try {
+    addBreakpoint(_debugInfo.findFunction(function), bid, true);
+  } catch (const std::runtime_error &e) {
+    Logging::debug("Monitor: no breakpoint at {} in {}: {}", function,
+                   _executable, e.what());
+  }
+}
+
+void Monitor::removeBreakpoint(breakpoint_id bid) {
+  // breakpoints at functions missing in the executable are not set
+  bool atFunction = _breakpointFunctions.erase(bid) > 0;
+  // a breakpoint at a line has a location per statement
+  std::vector<addr_t> addrs;
+  for (const auto &[addr, site] : _breakpoints) {
+    if (std::ranges::find(site.breakpoints, bid, &Breakpoint::id) !=
+        site.breakpoints.end())
+      addrs.push_back(addr);
+  }
+  for (addr_t addr : addrs)
+    removeBreakpoint(addr, bid);
+  if (addrs.empty() && !atFunction)
+    throw std::runtime_error(fmt::format("No breakpoint with id {}", bid));
+}
+
+void Monitor::setBreakpointCondition(breakpoint_id bid,
+                                     BreakCondition condition,
+                                     std::uint64_t ignoreCount) {
+  bool exists = std::ranges::any_of(_breakpoints, [&](const auto &entry) {
+    return std::ranges::find(entry.second.breakpoints, bid,
+                             &Breakpoint::id) != entry.second.breakpoints.end();
+  });
+  if (!exists && !_breakpointFunctions.contains(bid))
+    throw std::runtime_error(fmt::format("No breakpoint with id {}", bid));
+
+  _breakpointFilters[bid] =
+      BreakpointFilter{std::move(condition), ignoreCount, 0};
 }
 
-void Monitor::addBreakpoint(addr_t addr, breakpoint_id bid) {
+watchpoint_id Monitor::watchRegion(addr_t addr, std::size_t len) {
+  assert(_running);
+  constexpr addr_t pageSize = MemoryCache::pageSize;
+  if (len == 0)
+    throw std::runtime_error("Unable to watch an empty region");
+
+  // pages not watched yet, with their current protection
+  MemMaps maps;
+  maps.load(_childPid);
+  std::vector<std::pair<addr_t, int>> newPages;
+  for (addr_t page = addr & ~(pageSize - 1); page < addr + len;
+       page += pageSize) {
+    if (_watchedPages.contains(page))
+      continue;
+    const MemMaps::Mapping *mapping = maps.findMapping(page);
+    if (!mapping || !mapping->writable()) {
+      throw std::runtime_error(fmt::format(
+          "Unable to watch memory at 0x{:x}: not writable", page));
+    }
+    int protection = PROT_WRITE;
+    if (mapping->readable())
+      protection |= PROT_READ;
+    if (mapping->perms[2] == 'x')
+      protection |= PROT_EXEC;
+    newPages.emplace_back(page, protection);
+  }
+
+  installWatchFilter();
+  std::vector<addr_t> pages;
+  for (auto [page, protection] : newPages) {
+    _watchedPages.emplace(page, protection);
+    pages.push_back(page);
+  }
+  protectPages(_childPid, pages, _watchedPages, false);
+
+  watchpoint_id id = _nextWatchpointId++;
+  _watchedRegions.push_back(WatchedRegion{id, addr, len});
+  Logging::debug("Monitor: watching 0x{:x}-0x{:x}, {} pages protected", addr,
+                 addr + len, pages.size());
+  return id;
+}
+
+void Monitor::unwatchRegion(watchpoint_id id) {
+  constexpr addr_t pageSize = MemoryCache::pageSize;
+  auto it = std::ranges::find(_watchedRegions, id, &WatchedRegion::id);
+  if (it == _watchedRegions.end())
+    throw std::runtime_error(fmt::format("No watchpoint with id {}", id));
+  WatchedRegion removed = *it;
+  _watchedRegions.erase(it);
+
+  // pages of no other region get their protection back
+  std::vector<addr_t> pages;
+  for (addr_t page = removed.addr & ~(pageSize - 1);
+       page < removed.addr + removed.len; page += pageSize) {
+    if (std::ranges::none_of(_watchedRegions, [&](const WatchedRegion &r) {
+          return r.addr < page + pageSize && page < r.addr + r.len;
+        }))
+      pages.push_back(page);
+  }
+  if (_running)
+    protectPages(_childPid, pages, _watchedPages, true);
+  for (addr_t page : pages) {
+    _watchedPages.erase(page);
+    if (_watchFaultPage == page)
+      _watchFaultPage.reset();
+  }
+}
+
+void Monitor::traceFunction(const std::string &fname) {
+  addr_t addr = _debugInfo.findFunction(fname);
+  breakpoint_id bid = _nextInternalBreakpointId++;
+  addBreakpoint(addr, bid, true);
+  _tracedFunctions.emplace(bid, fname);
+}
+
+void Monitor::addBreakpoint(addr_t addr, breakpoint_id bid, bool persistent) {
 
   Logging::debug("Monitor: Adding bp at address 0x{:x}", addr);
 
-  long data = ::ptrace(PTRACE_PEEKTEXT, _childPid, (void *)addr, nullptr);
-  if (data == -1) {
-    throw std::runtime_error(fmt::format(
-        "Unable to arm a breakpoint (PEEKTEXT): {}", std::strerror(errno)));
+  // another breakpoint at the same address has the original byte already
+  auto [it, inserted] = _breakpoints.try_emplace(addr);
+  if (inserted) {
+    try {
+      it->second.originalByte = patchByte(addr, 0xcc);
+    } catch (...) {
+      _breakpoints.erase(it);
+      throw;
+    }
+  }
+  it->second.breakpoints.push_back(Breakpoint{bid, persistent});
+}
+
+void Monitor::addBreakpoints(
+    std::span<const std::pair<addr_t, breakpoint_id>> bps, bool persistent) {
+  // traps only where there are none yet, in address order: those within a
+  // word are written at once, and the code is read through the cache
+  std::vector<addr_t> newSites;
+  for (auto [addr, bid] : bps) {
+    if (!_breakpoints.contains(addr))
+      newSites.push_back(addr);
   }
+  std::ranges::sort(newSites);
+  auto [first, last] = std::ranges::unique(newSites);
+  newSites.erase(first, last);
+  // none added if any of the traps can't be written
+  std::vector<std::uint8_t> originalBytes = patchBytes(newSites, 0xcc);
 
-  Breakpoint bp;
-  bp.addr = addr;
-  bp.id = bid;
-  bp.originalData = data;
+  _breakpoints.reserve(_breakpoints.size() + newSites.size());
+  for (std::size_t i = 0; i < newSites.size(); ++i)
+    _breakpoints[newSites[i]].originalByte = originalBytes[i];
+  for (auto [addr, bid] : bps)
+    _breakpoints[addr].breakpoints.push_back(Breakpoint{bid, persistent});
+  Logging::debug("Monitor: added {} breakpoints, {} traps", bps.size(),
+                 newSites.size());
+}
 
-  Word64 w(data);
-  w.set8(0, 0xcc);
-  Logging::trace("Monitor: Setting bp at addr=0x{:x}, original data=0x{:x}, "
-                 "modified=0x{:x}",
-                 bp.addr, bp.originalData, w.get64());
+void Monitor::armBreakpoint(addr_t addr) { patchByte(addr, 0xcc); }
 
-  if (::ptrace(PTRACE_POKETEXT, _childPid, (void *)bp.addr, w.get64())) {
-    throw std::runtime_error(fmt::format(
-        "Unable to arm a breakpoint (POKETEXT): {}", std::strerror(errno)));
+std::uint8_t Monitor::patchByte(addr_t addr, std::uint8_t value) {
+  return patchBytes({&addr, 1}, value)[0];
+}
+
+std::vector<std::uint8_t> Monitor::patchBytes(std::span<const addr_t> addrs,
+                                              std::uint8_t value) {
+  // only single bytes are replaced, so that neighbouring breakpoints closer
+  // than a word are preserved. Breakpoints are often close, the code is read
+  // through the cache.
+  std::vector<std::uint8_t> previous(addrs.size());
+  std::size_t i = 0;
+  try {
+    while (i < addrs.size()) {
+      addr_t addr = addrs[i];
+      Word64 w;
+      if (_memoryCache.read(_childPid, addr, std::span(w.bytes(), 8),
+                            _debugInfo.maps()) != 8) {
+        // not readable for process_vm_readv, but still for ptrace
+        errno = 0;
+        w.set64(ptrace(PTRACE_PEEKTEXT, _childPid, (void *)addr, nullptr));
+        if (errno != 0) {
+          throw std::runtime_error(
+              fmt::format("Unable to patch code at 0x{:x} (PEEKTEXT): {}",
+                          addr, std::strerror(errno)));
+        }
+      }
+
+      std::uint64_t data = w.get64();
+      std::size_t end = i;
+      for (; end < addrs.size() && addrs[end] < addr + 8; ++end) {
+        previous[end] = w.get8(addrs[end] - addr);
+        w.set8(addrs[end] - addr, value);
+      }
+      Logging::trace("Monitor: patching addr=0x{:x}, original data=0x{:x}, "
+                     "modified=0x{:x}",
+                     addr, data, w.get64());
+
+      if (ptrace(PTRACE_POKETEXT, _childPid, (void *)addr, w.get64())) {
+        throw std::runtime_error(
+            fmt::format("Unable to patch code at 0x{:x} (POKETEXT): {}", addr,
+                        std::strerror(errno)));
+      }
+      for (; i < end; ++i)
+        _memoryCache.write(addrs[i], std::span(&value, 1));
+    }
+  } catch (const std::runtime_error &) {
+    // all or nothing: the bytes replaced so far are restored
+    for (std::size_t j = 0; j < i; ++j) {
+      errno = 0;
+      Word64 w(ptrace(PTRACE_PEEKTEXT, _childPid, (void *)addrs[j], nullptr));
+      if (errno != 0)
+        continue;
+      w.set8(0, previous[j]);
+      ptrace(PTRACE_POKETEXT, _childPid, (void *)addrs[j], w.get64());
+      _memoryCache.write(addrs[j], std::span(&previous[j], 1));
+    }
+    throw;
   }
+  return previous;
+}
 
-  _breakpoints.push_back(bp);
+void Monitor::removeBreakpoint(addr_t addr, breakpoint_id bid) {
+  auto it = _breakpoints.find(addr);
+  if (it == _breakpoints.end())
+    return;
+  std::vector<Breakpoint> &bps = it->second.breakpoints;
+  auto bp = std::ranges::find(bps, bid, &Breakpoint::id);
+  if (bp == bps.end())
+    return;
+  bps.erase(bp);
+  _breakpointFilters.erase(bid);
+
+  // the trap stays if other breakpoints share the address
+  if (bps.empty()) {
+    disarmBreakpoint(addr, it->second);
+    _breakpoints.erase(it);
+  }
 }
 
 void Monitor::dumpMem(addr_t addr, size_t len) {
   for (int i = 0; i < 10; ++i) {
     auto a = addr + i;
-    uint64_t data = ::ptrace(PTRACE_PEEKTEXT, _childPid, (void *)a, nullptr);
+    uint64_t data = ptrace(PTRACE_PEEKTEXT, _childPid, (void *)a, nullptr);
     fmt::println("0x{:02x} : 0x{:02x}", a, data & 0xff);
   }
 }
 
-void Monitor::disarmBreakpoint(const Breakpoint &bp) {
-  if (::ptrace(PTRACE_POKETEXT, _childPid, (void *)bp.addr,
-               (void *)(bp.originalData))) {
+void Monitor::disarmBreakpoint(addr_t addr, const BreakpointSite &site) {
+  patchByte(addr, site.originalByte);
+}
+
+std::vector<addr_t> Monitor::backtrace(std::size_t maxFrames) {
+  assert(_running);
+
+  auto frames = unwindStack(maxFrames);
+
+  // a frame outside of known mappings means that libraries were loaded
+  // since the maps were read
+  const MemMaps &maps = _debugInfo.maps();
+  if (std::ranges::any_of(frames,
+                          [&](addr_t ip) { return !maps.findMapping(ip); })) {
+    _debugInfo.reloadMaps(_childPid);
+    frames = unwindStack(maxFrames);
+  }
+  return frames;
+}
+
+Snapshot Monitor::takeSnapshot() {
+  assert(_running);
+  _debugInfo.reloadMaps(_childPid);
+  return Snapshot(_childPid, _debugInfo.maps());
+}
+
+std::vector<Snapshot::PageChange> Monitor::updateSnapshot(Snapshot &snapshot) {
+  assert(_running);
+  _debugInfo.reloadMaps(_childPid);
+  return snapshot.update(_debugInfo.maps());
+}
+
+std::vector<addr_t> Monitor::unwindStack(std::size_t maxFrames) {
+
+  // upper limit of the stack copied per backtrace
+  constexpr std::uint64_t maxStackCopy = 256 * 1024;
+
+  const Registers &regs = _recentState.registers;
+  addr_t sp = regs[Registers::SP].get64();
+
+  // copy the whole used part of the stack in one go
+  std::size_t copied = 0;
+  if (const MemMaps::Mapping *stack = _debugInfo.maps().findMapping(sp)) {
+    std::size_t len = std::min(stack->high - sp, maxStackCopy);
+    _stackCopy.resize(len);
+
+    ::iovec local{_stackCopy.data(), len};
+    ::iovec remote{(void *)sp, len};
+    ::ssize_t res = ::process_vm_readv(_childPid, &local, 1, &remote, 1, 0);
+    if (res < 0) {
+      Logging::error("Monitor: failed to read stack at 0x{:x}: {}", sp,
+                     std::strerror(errno));
+    } else {
+      copied = res;
+      _stats.bytesRead += res;
+    }
+  }
+
+  return _unwinder.unwind(regs, _debugInfo.maps(),
+                          std::span(_stackCopy.data(), copied), sp,
+                          maxFrames);
+}
+
+tracepoint_id Monitor::addTracepoint(addr_t addr) {
+  assert(_running);
+
+  // jmp rel32
+  constexpr std::size_t jumpLength = 5;
+
+  if (!_tracepointRingAddr)
+    mapTracepointRing();
+
+  // whole instructions are replaced, the ones covering the jump
+  // the longest instruction may be the last one replaced
+  auto code = readMemory(addr, jumpLength + maxInstructionLength);
+  auto patchLength =
+      relocateInstructions(code, addr, addr, jumpLength).size();
+  code.resize(patchLength);
+
+  auto overlaps = [&](addr_t a, std::size_t len) {
+    return a < addr + patchLength && addr < a + len;
+  };
+  for (std::size_t i = 0; i < patchLength; ++i) {
+    if (_breakpoints.contains(addr + i)) {
+      throw std::runtime_error(fmt::format(
+          "Tracepoint at 0x{:x} would overwrite a breakpoint", addr));
+    }
+  }
+  for (const Tracepoint &tp : _tracepoints) {
+    if (overlaps(tp.addr, tp.originalCode.size())) {
+      throw std::runtime_error(fmt::format(
+          "Tracepoint at 0x{:x} overlaps another tracepoint", addr));
+    }
+  }
+
+  // the size of the trampoline doesn't depend on its address, relocated
+  // instructions keep their length: it's measured by making it in place
+  tracepoint_id id = _tracepoints.size();
+  std::size_t trampolineSize =
+      _tracepointRing->makeTrampoline(id, addr, _tracepointRingAddr, addr, code)
+          .size();
+  addr_t trampolineAddr = allocateTrampoline(addr, trampolineSize);
+  auto trampoline = _tracepointRing->makeTrampoline(
+      id, trampolineAddr, _tracepointRingAddr, addr, code);
+  if (trampoline.size() > trampolineSize) {
+    throw std::runtime_error(fmt::format(
+        "Trampoline of {} bytes for 0x{:x} doesn't fit in {} bytes",
+        trampoline.size(), addr, trampolineSize));
+  }
+  writeMemory(trampolineAddr, trampoline);
+
+  std::vector<std::uint8_t> jump(patchLength, 0x90); // nop-padded
+  std::int32_t rel =
+      std::int64_t(trampolineAddr) - std::int64_t(addr + jumpLength);
+  jump[0] = 0xe9;
+  std::memcpy(jump.data() + 1, &rel, sizeof(rel));
+  writeMemory(addr, jump);
+
+  Logging::debug("Monitor: tracepoint {} at 0x{:x}, trampoline at 0x{:x}", id,
+                 addr, trampolineAddr);
+  _tracepoints.push_back(Tracepoint{addr, std::move(code)});
+  return id;
+}
+
+tracepoint_id Monitor::addFunctionTracepoint(const std::string &fname) {
+  return addTracepoint(_debugInfo.findFunction(fname));
+}
+
+void Monitor::removeTracepoint(tracepoint_id id) {
+  Tracepoint &tp = _tracepoints.at(id);
+  // the trampoline stays, threads may still be running it
+  writeMemory(tp.addr, tp.originalCode);
+  tp.originalCode.clear();
+}
+
+std::uint64_t
+Monitor::collectTracepointHits(std::vector<TracepointHit> &hits) {
+  if (!_tracepointRing)
+    return 0;
+  return _tracepointRing->drain(hits);
+}
+
+void Monitor::mapTracepointRing() {
+  // a process restored from a checkpoint maps the existing ring again
+  if (!_tracepointRing)
+    _tracepointRing = std::make_unique<TracepointRing>();
+  TracepointRing &ring = *_tracepointRing;
+
+  // the process opens the ring through our fd; the path is passed on its
+  // stack, below the red zone
+  std::string path = fmt::format("/proc/{}/fd/{}", ::getpid(), ring.fd());
+  addr_t sp = _recentState.registers[Registers::SP].get64();
+  addr_t pathAddr = (sp - 128 - path.size() - 1) & ~addr_t(15);
+  writeMemory(pathAddr, std::span(reinterpret_cast<const std::uint8_t *>(
+                                      path.c_str()),
+                                  path.size() + 1));
+
+  long fd = injectSyscall(SYS_openat, {std::uint64_t(AT_FDCWD), pathAddr,
+                                       O_RDWR | O_CLOEXEC});
+  if (fd < 0) {
+    throw std::runtime_error(fmt::format(
+        "Failed to open tracepoint ring in the process: {}", strerror(-fd)));
+  }
+
+  long addr = injectSyscall(SYS_mmap, {0, ring.size(),
+                                       PROT_READ | PROT_WRITE, MAP_SHARED,
+                                       std::uint64_t(fd), 0});
+  injectSyscall(SYS_close, {std::uint64_t(fd)});
+  if (addr < 0 && addr >= -4095) {
+    throw std::runtime_error(fmt::format(
+        "Failed to map tracepoint ring in the process: {}", strerror(-addr)));
+  }
+
+  _tracepointRingAddr = addr;
+}
+
+addr_t Monitor::allocateTrampoline(addr_t near, std::size_t size) {
+  // allocated in the process at once, and handed out in 16-byte units
+  constexpr std::size_t codeAreaSize = 64 * 1024;
+  size = (size + 15) & ~std::size_t(15);
+  if (size > codeAreaSize) {
+    throw std::runtime_error(
+        fmt::format("Trampoline of {} bytes is too large", size));
+  }
+  // leaves room for RIP-relative operands of the relocated code
+  constexpr addr_t maxDistance = 1ull << 30;
+
+  auto distance = [&](addr_t a) {
+    return std::max(a, near) - std::min(a, near);
+  };
+  auto inRange = [&](addr_t a) { return distance(a) < maxDistance; };
+
+  auto it = std::ranges::find_if(_codeAreas, [&](const CodeArea &area) {
+    return area.used + size <= codeAreaSize && inRange(area.start);
+  });
+  if (it == _codeAreas.end()) {
+    // the gap between mappings closest to `near`
+    _debugInfo.reloadMaps(_childPid);
+    constexpr addr_t lowest = 0x10000;       // vm.mmap_min_addr
+    constexpr addr_t highest = 0x7ffffffff000; // end of user space
+    std::optional<addr_t> best;
+    addr_t gapStart = lowest;
+    auto consider = [&](addr_t gapEnd) {
+      if (gapEnd < gapStart + codeAreaSize)
+        return;
+      addr_t candidate = near < gapStart ? gapStart : gapEnd - codeAreaSize;
+      if (!best || distance(candidate) < distance(*best))
+        best = candidate;
+    };
+    for (const auto &mapping : _debugInfo.maps().mappings()) {
+      if (mapping.low >= highest)
+        break;
+      consider(mapping.low);
+      gapStart = std::max(gapStart, mapping.high);
+    }
+    consider(highest);
+
+    if (!best || !inRange(*best)) {
+      throw std::runtime_error(fmt::format(
+          "No free memory for a trampoline near 0x{:x}", near));
+    }
+
+    long addr = injectSyscall(
+        SYS_mmap, {*best, codeAreaSize, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                   std::uint64_t(-1), 0});
+    if (addr != long(*best)) {
+      throw std::runtime_error(fmt::format(
+          "Failed to map trampolines at 0x{:x}: {}", *best,
+          addr < 0 ? strerror(-addr) : "mapped elsewhere"));
+    }
+    _codeAreas.push_back(CodeArea{*best});
+    it = std::prev(_codeAreas.end());
+  }
+
+  addr_t addr = it->start + it->used;
+  it->used += size;
+  return addr;
+}
+
+long Monitor::injectSyscall(long number,
+                            std::initializer_list<std::uint64_t> args) {
+  return injectSyscall(_childPid, number, args);
+}
+
+long Monitor::injectSyscall(int pid, long number,
+                            std::initializer_list<std::uint64_t> args) {
+  assert(args.size() <= 6);
+
+  ::user_regs_struct saved;
+  ptrace(PTRACE_GETREGS, pid, 0, &saved);
+
+  // the syscall instruction replaces the code at IP for a moment
+  addr_t ip = saved.rip;
+  errno = 0;
+  long savedCode = ptrace(PTRACE_PEEKTEXT, pid, (void *)ip, nullptr);
+  if (errno != 0) {
     throw std::runtime_error(fmt::format(
-        "Unable to disarm a breakpoint (POKETEXT): {}", std::strerror(errno)));
+        "Unable to inject syscall at 0x{:x}: {}", ip, std::strerror(errno)));
+  }
+  Word64 code(savedCode);
+  code.set8(0, 0x0f);
+  code.set8(1, 0x05);
+  ptrace(PTRACE_POKETEXT, pid, (void *)ip, code.get64());
+
+  ::user_regs_struct regs = saved;
+  regs.rax = number;
+  regs.orig_rax = -1; // no syscall restart
+  unsigned long long *argRegs[] = {&regs.rdi, &regs.rsi, &regs.rdx,
+                                   &regs.r10, &regs.r8,  &regs.r9};
+  std::size_t i = 0;
+  for (std::uint64_t arg : args)
+    *argRegs[i++] = arg;
+  ptrace(PTRACE_SETREGS, pid, 0, &regs);
+
+  // the process runs, if only for the syscall
+  _memoryCache.invalidate();
+
+  BOOST_SCOPE_EXIT(this_, pid, ip, savedCode, &saved) {
+    this_->ptrace(PTRACE_POKETEXT, pid, (void *)ip, savedCode);
+    this_->ptrace(PTRACE_SETREGS, pid, 0, &saved);
+  }
+  BOOST_SCOPE_EXIT_END
+
+  while (true) {
+    ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+    int wstatus;
+    ::waitpid(pid, &wstatus, 0);
+    if (!WIFSTOPPED(wstatus)) {
+      if (pid == _childPid)
+        _running = false;
+      throw std::runtime_error("Process finished in injected syscall");
+    }
+
+    // a seccomp stop, if the syscall is traced, or a fork event: let it run
+    if (wstatus >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)) ||
+        wstatus >> 8 == (SIGTRAP | (PTRACE_EVENT_FORK << 8)))
+      continue;
+    if (WSTOPSIG(wstatus) == SIGTRAP)
+      break;
+
+    // signals arriving meanwhile are delivered on the next resume; those of
+    // checkpoints (SIGCHLD of the processes restored from them) are dropped
+    if (pid != _childPid)
+      continue;
+    if (isInterruptStop(wstatus))
+      _interruptRequested = false;
+    else
+      _pendingSignal = WSTOPSIG(wstatus);
+  }
+
+  ptrace(PTRACE_GETREGS, pid, 0, &regs);
+  Logging::trace("Monitor: injected syscall {} = {}", syscallName(number),
+                 (long)regs.rax);
+  return regs.rax;
+}
+
+int Monitor::forkProcess(int pid) {
+  ::user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, pid, 0, &regs);
+  errno = 0;
+  long code = ptrace(PTRACE_PEEKTEXT, pid, (void *)regs.rip, nullptr);
+  if (errno != 0) {
+    throw std::runtime_error(fmt::format("Unable to fork process {}: {}", pid,
+                                         std::strerror(errno)));
   }
+
+  // the copy is traced from the start, stopped with SIGSTOP
+  setTracingOptions(pid, _tracingOptions | PTRACE_O_TRACEFORK);
+  long child = injectSyscall(pid, SYS_fork, {});
+  setTracingOptions(pid, _tracingOptions);
+  if (child < 0) {
+    throw std::runtime_error(fmt::format("Unable to fork process {}: {}", pid,
+                                         std::strerror(-child)));
+  }
+
+  int wstatus;
+  ::waitpid(child, &wstatus, __WALL);
+  if (!WIFSTOPPED(wstatus)) {
+    throw std::runtime_error(
+        fmt::format("Unexpected initial state of the fork: {}", wstatus));
+  }
+
+  // the copy stopped after the injected syscall, with it still in the code
+  ptrace(PTRACE_POKETEXT, child, (void *)regs.rip, code);
+  ptrace(PTRACE_SETREGS, child, 0, &regs);
+  setTracingOptions(child, _tracingOptions);
+  Logging::debug("Monitor: forked process {} as {}", pid, child);
+  return child;
+}
+
+std::optional<Monitor::ChildProcess> Monitor::detachChild(int pid,
+                                                         bool sharesMemory) {
+  // traced from the start, stopped with SIGSTOP
+  int wstatus;
+  ::waitpid(pid, &wstatus, __WALL);
+
+  if (sharesMemory) {
+    // a vfork child runs in the memory of the parent, with its traps, until
+    // it execs; the parent waits for it meanwhile
+    while (WIFSTOPPED(wstatus) && wstatus >> 16 != PTRACE_EVENT_EXEC) {
+      ::user_regs_struct regs;
+      ptrace(PTRACE_GETREGS, pid, 0, &regs);
+      int signal = WSTOPSIG(wstatus);
+      auto site = _breakpoints.find(regs.rip - 1);
+      if (signal == SIGTRAP && site != _breakpoints.end()) {
+        regs.rip -= 1;
+        ptrace(PTRACE_SETREGS, pid, 0, &regs);
+        disarmBreakpoint(site->first, site->second);
+        ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+        ::waitpid(pid, &wstatus, __WALL);
+        armBreakpoint(site->first);
+        continue;
+      }
+      if (signal == SIGSEGV && !_watchedPages.empty()) {
+        // a write to a watched page is done with the page writable
+        ::siginfo_t info{};
+        ptrace(PTRACE_GETSIGINFO, pid, 0, &info);
+        addr_t page =
+            addr_t(info.si_addr) & ~addr_t(MemoryCache::pageSize - 1);
+        if (info.si_code == SEGV_ACCERR && _watchedPages.contains(page)) {
+          protectPages(pid, {&page, 1}, _watchedPages, true);
+          ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+          ::waitpid(pid, &wstatus, __WALL);
+          // through the parent if the child is gone, the memory is the same
+          protectPages(WIFSTOPPED(wstatus) ? pid : _childPid, {&page, 1},
+                       _watchedPages, false);
+          continue;
+        }
+      }
+      // SIGSTOP and SIGTRAP are ours: the start, seccomp and other events
+      if (signal == SIGSTOP || signal == SIGTRAP)
+        signal = 0;
+      ptrace(PTRACE_CONT, pid, nullptr, (void *)(long)signal);
+      ::waitpid(pid, &wstatus, __WALL);
+    }
+    if (!WIFSTOPPED(wstatus)) {
+      Logging::debug("Monitor: vfork child {} finished: {}", pid, wstatus);
+      return std::nullopt;
+    }
+  } else {
+    // a copy of the memory of the parent
+    for (const auto &[addr, site] : _breakpoints) {
+      errno = 0;
+      Word64 code(ptrace(PTRACE_PEEKTEXT, pid, (void *)addr, nullptr));
+      if (errno != 0)
+        continue;
+      code.set8(0, site.originalByte);
+      ptrace(PTRACE_POKETEXT, pid, (void *)addr, code.get64());
+    }
+    // the ring is shared, hits in the child would count as the parent's
+    for (const Tracepoint &tracepoint : _tracepoints) {
+      if (!tracepoint.originalCode.empty())
+        writeMemory(pid, tracepoint.addr, tracepoint.originalCode);
+    }
+    std::vector<addr_t> pages;
+    for (auto [page, protection] : _watchedPages)
+      pages.push_back(page);
+    std::ranges::sort(pages);
+    protectPages(pid, pages, _watchedPages, true);
+  }
+
+  // stopped again once detached, until attached by another tracer
+  ::kill(pid, SIGSTOP);
+  ptrace(PTRACE_DETACH, pid, nullptr, nullptr);
+
+  ChildProcess child{pid};
+  child.tracedSyscalls = _tracedSyscalls;
+  for (const auto &[id, function] : _breakpointFunctions) {
+    FunctionBreakpoint bp{function, id};
+    if (auto it = _breakpointFilters.find(id); it != _breakpointFilters.end()) {
+      bp.condition = it->second.condition;
+      bp.ignoreCount = it->second.ignoreCount;
+    }
+    child.breakpoints.push_back(std::move(bp));
+  }
+  Logging::debug("Monitor: process {} forked {}", _childPid, pid);
+  return child;
+}
+
+void Monitor::reloadExecutable() {
+  _executable =
+      std::filesystem::read_symlink(fmt::format("/proc/{}/exe", _childPid));
+  Logging::debug("Monitor: process {} executed {}", _childPid, _executable);
+  _debugInfo = ProcessDebugInfo(_childPid, _executable,
+                                ProcessDebugInfo::loadAsync(_executable));
+  _memoryCache.invalidate();
+
+  // nothing of the monitor is left in the new memory
+  _breakpoints.clear();
+  _returnBreakpoints.clear();
+  _coverageBreakpoints.clear();
+  _coverageArmed = false;
+  _tracepointRingAddr = 0;
+  for (Tracepoint &tracepoint : _tracepoints)
+    tracepoint.originalCode.clear();
+  _codeAreas.clear();
+  _displacedStepSlots.clear();
+  _watchedRegions.clear();
+  _watchedPages.clear();
+  _watchFaultPage.reset();
+  // checkpoints run the old executable
+  for (const auto &[id, checkpoint] : _checkpoints)
+    killProcess(checkpoint.pid);
+  _checkpoints.clear();
+  _restoredFrom = 0;
+
+  for (const auto &[id, function] : _breakpointFunctions)
+    setFunctionBreakpoint(id, function);
+  for (const auto &[id, function] : _tracedFunctions)
+    setFunctionBreakpoint(id, function);
+}
+
+void Monitor::killProcess(int pid) {
+  ::kill(pid, SIGKILL);
+  // stops reported before the kill are skipped
+  int wstatus;
+  while (::waitpid(pid, &wstatus, __WALL) == pid && WIFSTOPPED(wstatus)) {
+  }
+}
+
+void Monitor::reapRestoredProcess() {
+  // the checkpoint process is its parent, not the monitor
+  if (_restoredFrom == 0)
+    return;
+  int parent = std::exchange(_restoredFrom, 0);
+  long res = injectSyscall(parent, SYS_wait4,
+                           {std::uint64_t(_childPid), 0, WNOHANG | __WALL, 0});
+  if (res != _childPid) {
+    Logging::error("Monitor: process {} not reaped by checkpoint {}: {}",
+                   _childPid, parent, res);
+  }
+}
+
+checkpoint_id Monitor::checkpoint() {
+  assert(_running);
+
+  Checkpoint checkpoint;
+  checkpoint.pid = forkProcess(_childPid);
+  checkpoint.pendingSignal = _pendingSignal;
+  for (const auto &[addr, site] : _breakpoints)
+    checkpoint.traps.emplace(addr, site.originalByte);
+  checkpoint.tracepointRingAddr = _tracepointRingAddr;
+  checkpoint.tracepoints = _tracepoints;
+  checkpoint.codeAreas = _codeAreas;
+  checkpoint.watchedPages = _watchedPages;
+  checkpoint.watchFilterInstalled = _watchFilterInstalled;
+
+  checkpoint_id id = _nextCheckpointId++;
+  Logging::debug("Monitor: checkpoint {} in process {}", id, checkpoint.pid);
+  _checkpoints.emplace(id, std::move(checkpoint));
+  return id;
+}
+
+void Monitor::restore(checkpoint_id id) {
+  auto it = _checkpoints.find(id);
+  if (it == _checkpoints.end())
+    throw std::runtime_error(fmt::format("No checkpoint {}", id));
+  const Checkpoint &checkpoint = it->second;
+
+  int pid = forkProcess(checkpoint.pid);
+  if (_running) {
+    killProcess(_childPid);
+    reapRestoredProcess();
+  }
+
+  Logging::debug("Monitor: restored checkpoint {} in process {}", id, pid);
+  _childPid = pid;
+  _restoredFrom = checkpoint.pid;
+  _running = true;
+  _pendingSignal = checkpoint.pendingSignal;
+  _interruptRequested = false;
+  _lastResumeRequest = PTRACE_CONT;
+  _memoryCache.invalidate();
+
+  // breakpoints added or removed since the checkpoint
+  for (auto [addr, originalByte] : checkpoint.traps) {
+    if (!_breakpoints.contains(addr))
+      patchByte(addr, originalByte);
+  }
+  for (const auto &[addr, site] : _breakpoints) {
+    if (!checkpoint.traps.contains(addr))
+      armBreakpoint(addr);
+  }
+
+  // the code as patched in the checkpoint
+  _tracepointRingAddr = checkpoint.tracepointRingAddr;
+  _tracepoints = checkpoint.tracepoints;
+  _codeAreas = checkpoint.codeAreas;
+  // slots allocated since are not mapped in the restored process
+  _displacedStepSlots.clear();
+
+  // pages watched or unwatched since the checkpoint
+  std::vector<addr_t> watched, unwatched;
+  for (auto [page, protection] : checkpoint.watchedPages) {
+    if (!_watchedPages.contains(page))
+      unwatched.push_back(page);
+  }
+  for (auto [page, protection] : _watchedPages) {
+    if (!checkpoint.watchedPages.contains(page))
+      watched.push_back(page);
+  }
+  std::ranges::sort(watched);
+  std::ranges::sort(unwatched);
+  protectPages(_childPid, unwatched, checkpoint.watchedPages, true);
+  protectPages(_childPid, watched, _watchedPages, false);
+  _watchFaultPage.reset();
+
+  _debugInfo.reloadMaps(_childPid);
+  ::user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, _childPid, 0, &regs);
+  _recentState.registers = Registers::fromLinux(regs);
+
+  // the filter, for regions watched since the checkpoint
+  _watchFilterInstalled = checkpoint.watchFilterInstalled;
+  if (!_watchedPages.empty())
+    installWatchFilter();
+}
+
+void Monitor::dropCheckpoint(checkpoint_id id) {
+  auto it = _checkpoints.find(id);
+  if (it == _checkpoints.end())
+    throw std::runtime_error(fmt::format("No checkpoint {}", id));
+  killProcess(it->second.pid);
+  // the process restored from it is left to init
+  if (_restoredFrom == it->second.pid)
+    _restoredFrom = 0;
+  _checkpoints.erase(it);
+}
+
+std::vector<std::uint8_t> Monitor::readMemory(addr_t addr, std::size_t len) {
+  assert(_running);
+  std::vector<std::uint8_t> data(len);
+  std::size_t count =
+      _memoryCache.read(_childPid, addr, data, _debugInfo.maps());
+  if (count == 0 && len > 0) {
+    throw std::runtime_error(
+        fmt::format("Unable to read memory at 0x{:x}", addr));
+  }
+  data.resize(count);
+  return data;
+}
+
+void Monitor::writeMemory(addr_t addr, std::span<const std::uint8_t> data) {
+  writeMemory(_childPid, addr, data);
+}
+
+void Monitor::writeMemory(int pid, addr_t addr,
+                          std::span<const std::uint8_t> data) {
+  // word by word with POKEDATA, which can write read-only mappings
+  addr_t start = addr & ~addr_t(7);
+  for (addr_t word = start; word < addr + data.size(); word += 8) {
+    Word64 w;
+    if (word < addr || word + 8 > addr + data.size()) {
+      errno = 0;
+      w.set64(ptrace(PTRACE_PEEKDATA, pid, (void *)word, nullptr));
+      if (errno != 0) {
+        throw std::runtime_error(
+            fmt::format("Unable to write memory at 0x{:x} (PEEKDATA): {}",
+                        word, std::strerror(errno)));
+      }
+    }
+    for (int i = 0; i < 8; ++i) {
+      if (word + i >= addr && word + i < addr + data.size())
+        w.set8(i, data[word + i - addr]);
+    }
+    if (ptrace(PTRACE_POKEDATA, pid, (void *)word, w.get64())) {
+      throw std::runtime_error(
+          fmt::format("Unable to write memory at 0x{:x} (POKEDATA): {}", word,
+                      std::strerror(errno)));
+    }
+  }
+  if (pid == _childPid)
+    _memoryCache.write(addr, data);
+}
+
+std::vector<VariableValue> Monitor::readLocals() {
+  using Kind = LocationExpression::Location::Kind;
+  assert(_running);
+  const Registers &regs = _recentState.registers;
+
+  auto scope = _debugInfo.findFunctionScope(regs[Registers::IP].get64());
+  if (!scope)
+    return {};
+  const FileDebugInfo::FunctionRange &function = *scope->function;
+
+  LocationExpression::Context context{regs};
+  context.cfa = _unwinder.currentCfa(regs, _debugInfo.maps());
+  context.loadBias = scope->loadBias;
+  if (const LocationExpression *frameBase =
+          findLocation(function.frameBase, scope->offset)) {
+    auto location = frameBase->evaluate(context);
+    if (location && location->kind == Kind::Memory)
+      context.frameBase = location->value;
+    else if (location && location->kind == Kind::Register)
+      context.frameBase = regs[location->value].get64();
+  }
+
+  std::vector<VariableValue> values;
+  values.reserve(function.variables.size());
+  // variables in memory, read with one syscall
+  std::vector<::iovec> local;
+  std::vector<::iovec> remote;
+  std::vector<std::size_t> inMemory; // indexes of the values
+
+  for (const Variable &variable : function.variables) {
+    VariableValue &value = values.emplace_back(VariableValue{&variable});
+    const LocationExpression *expression =
+        findLocation(variable.locations, scope->offset);
+    std::size_t size = variable.type ? variable.type->size : 0;
+    if (!expression || size == 0)
+      continue;
+    auto location = expression->evaluate(context);
+    if (!location)
+      continue;
+
+    switch (location->kind) {
+    case Kind::Memory:
+      size = std::min(size, maxVariableRead);
+      value.bytes.emplace(size);
+      local.push_back(::iovec{value.bytes->data(), size});
+      remote.push_back(::iovec{(void *)location->value, size});
+      inMemory.push_back(values.size() - 1);
+      break;
+    case Kind::Register: {
+      Word64 word = regs[location->value];
+      value.bytes.emplace(word.bytes(),
+                          word.bytes() + std::min(size, sizeof(word)));
+      break;
+    }
+    case Kind::Value: {
+      Word64 word(location->value);
+      value.bytes.emplace(word.bytes(),
+                          word.bytes() + std::min(size, sizeof(word)));
+      break;
+    }
+    }
+  }
+
+  // the read stops at the first unreadable variable, the rest is read again
+  std::size_t next = 0;
+  while (next < remote.size()) {
+    std::size_t count = std::min(remote.size() - next, maxIovecs);
+    std::size_t end = next + count;
+    ::ssize_t res = ::process_vm_readv(_childPid, &local[next], count,
+                                       &remote[next], count, 0);
+    std::size_t read = std::max<::ssize_t>(res, 0);
+    _stats.bytesRead += read;
+    for (; next < end && read >= remote[next].iov_len; ++next)
+      read -= remote[next].iov_len;
+    if (next < end)
+      values[inMemory[next++]].bytes.reset();
+  }
+
+  return values;
+}
+
+MonitorStats Monitor::stats() const {
+  MonitorStats stats = _stats;
+  stats.bytesRead += _memoryCache.stats().bytesRead;
+  return stats;
 }
 
 std::optional<SourceLocation> Monitor::currentSourceLocation() const {
+  ScopedLatency latency(_stats.phase(MonitorStats::Phase::Symbolize));
   return _debugInfo.findSourceLocation(
       _recentState.registers[Registers::IP].get64());
 }
@@ -1,75 +1,466 @@
 #pragma once
 
+#include "alloc_tracker.hh"
+#include "break_condition.hh"
+#include "call_trace.hh"
+#include "coverage.hh"
+#include "memory_cache.hh"
+#include "monitor_stats.hh"
 #include "process_debug_info.hh"
+#include "profile.hh"
 #include "registers.hh"
+#include "snapshot.hh"
 #include "source_location.hh"
+#include "syscalls.hh"
+#include "tracepoints.hh"
+#include "unwinder.hh"
+#include "variables.hh"
 #include "word.hh"
+#include "x86_decoder.hh"
 
+#include <chrono>
+#include <initializer_list>
 #include <memory>
+#include <span>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
 namespace Whiteboard {
 
 using addr_t = std::uint64_t;
 using breakpoint_id = std::uint64_t;
+using checkpoint_id = std::uint64_t;
+using watchpoint_id = std::uint64_t;
 
 class Monitor {
 public:
   using Args = std::vector<std::string>;
 
-  enum class StopReason { Breakpoint, Finished, Other };
+  struct RunOptions {
+    // Numbers of syscalls reported as StopReason::Syscall. A seccomp filter
+    // is installed in the process, so the other syscalls don't stop it.
+    std::vector<long> tracedSyscalls;
+    // Preloads alloc_agent into the process, reporting heap usage to
+    // allocTracker(). Requires a dynamically linked executable.
+    bool trackAllocations = false;
+    // Children forked by the process are reported as StopReason::Fork, to be
+    // traced by attachChild(). On exec, the debug info of the new executable
+    // replaces the old one, and the breakpoints at functions are set again.
+    bool followChildren = false;
+  };
+
+  enum class StopReason {
+    Breakpoint,
+    Syscall,
+    Finished,
+    Other,
+    Watchpoint,
+    Fork,
+    Exec,
+  };
+  static_assert(std::size_t(StopReason::Exec) + 1 ==
+                    MonitorStats::numStopReasons,
+                "MonitorStats counts the stops by StopReason");
+  static const char *stopReasonName(StopReason reason);
+
+  // a breakpoint set by breakAtFunction(), carried to children by name
+  struct FunctionBreakpoint {
+    std::string function;
+    breakpoint_id id;
+    std::optional<BreakCondition> condition;
+    std::uint64_t ignoreCount = 0;
+  };
+
+  // A child forked by a process followed with RunOptions::followChildren,
+  // detached and stopped until attachChild(). Its memory is free of the
+  // traps and protected pages of the parent.
+  struct ChildProcess {
+    int pid;
+    std::vector<FunctionBreakpoint> breakpoints;
+    // reported syscalls; the seccomp filter is inherited
+    std::vector<long> tracedSyscalls;
+  };
 
   struct StopState {
     StopReason reason;
     breakpoint_id breakpoint = 0;
+    int signal = 0; // signal that stopped the process, if reason is Other
+    // if reason is Watchpoint: the region, and the address being written by
+    // the instruction at IP
+    watchpoint_id watchpoint = 0;
+    addr_t address = 0;
+    // if reason is Fork, or Syscall of a fork
+    std::optional<ChildProcess> child;
+    // completed syscall, if reason is Syscall, or Watchpoint hit by it
+    std::optional<SyscallInfo> syscall;
   };
 
   Monitor(const Monitor &) = delete;
   Monitor(Monitor &&) = delete;
   ~Monitor();
 
-  static Monitor runExecutable(const std::string &executable, const Args &args);
+  static Monitor runExecutable(const std::string &executable, const Args &args,
+                               const RunOptions &options);
+  static Monitor runExecutable(const std::string &executable,
+                               const Args &args) {
+    return runExecutable(executable, args, RunOptions{});
+  }
+  // Traces the child with the breakpoints of its parent, following its own
+  // children. The child is traced by the calling thread, which doesn't have
+  // to be the one tracing the parent.
+  static Monitor attachChild(const ChildProcess &child);
 
   bool isRunning() const { return _running; }
+  int pid() const { return _childPid; }
+  const std::string &executable() const { return _executable; }
 
-  // breakpoints
+  // Breakpoints stay armed until removed. The process steps over them with
+  // the trap in place: the original instruction is executed from a copy
+  // elsewhere in the process' memory.
   void breakAtFunction(const std::string &functionName, breakpoint_id bid);
+  // Breaks at each statement of the line, all with the same id: inlined and
+  // instantiated code has many. The file is matched by the end of its path,
+  // e.g. "src/main.cc". Not carried to children, nor across exec.
+  void breakAtLine(const std::string &file, int line, breakpoint_id bid);
+  void removeBreakpoint(breakpoint_id bid);
+  // The first `ignoreCount` hits of the breakpoint are ignored, after that
+  // only hits meeting the condition stop the process. Checked by the monitor
+  // on each hit, other hits don't return from cont().
+  void setBreakpointCondition(breakpoint_id bid, BreakCondition condition,
+                              std::uint64_t ignoreCount = 0);
+
+  // Software watchpoints, for regions of any size: the pages covering the
+  // region are made read-only in the process. A write into the region stops
+  // the process before the write, which is done when it resumes. Writes
+  // elsewhere in the pages cost a stop each, but don't return from cont().
+  // Syscalls known to write into memory stop the process, by a seccomp
+  // filter installed with the first region; those writing into watched pages
+  // are run with the pages writable, and stop as a hit if they wrote into a
+  // region. The filter stays, children forked after get it too: they need a
+  // tracer, see RunOptions::followChildren. Other syscalls, like ioctl,
+  // fail with EFAULT on the pages.
+  watchpoint_id watchRegion(addr_t addr, std::size_t len);
+  void unwatchRegion(watchpoint_id id);
+
+  // call tracing: adds a persistent breakpoint at the function entry
+  void traceFunction(const std::string &functionName);
 
   // execution control
   StopState stepi();
   StopState cont();
 
+  // Continues like cont(), but interrupts the process every `interval` to
+  // record its IP in the profile. Returns on the first stop not caused by
+  // sampling.
+  StopState sample(std::chrono::microseconds interval, Profile &profile);
+
+  // Continues like cont(), recording entries and exits of functions
+  // registered with traceFunction() in the trace. Each call costs two stops:
+  // at the entry, and at the return address. Returns on the first stop not
+  // caused by tracing.
+  StopState traceCalls(CallTrace &trace);
+
+  // Continues like cont(), collecting line coverage of the executable. On the
+  // first call, a one-shot breakpoint is placed at the beginning of each
+  // statement, and the lines are added to the coverage. A hit marks its lines
+  // covered and removes the breakpoint, so covered code runs at full speed.
+  // Returns on the first stop not caused by coverage.
+  StopState collectCoverage(Coverage &coverage);
+
+  // Fast tracepoints: the code at the address is replaced with a jump to a
+  // trampoline, recording the registers in memory shared with the monitor.
+  // The process doesn't stop at them. The address must start an instruction,
+  // and the instructions replaced (5 bytes at least) must not be jump
+  // targets.
+  tracepoint_id addTracepoint(addr_t addr);
+  tracepoint_id addFunctionTracepoint(const std::string &functionName);
+  void removeTracepoint(tracepoint_id id);
+  // Moves hits recorded so far to `hits`, returns the number of hits lost
+  // because they were not collected in time. Unlike the other methods, can be
+  // called from another thread while the process runs.
+  std::uint64_t collectTracepointHits(std::vector<TracepointHit> &hits);
+
+  // Checkpoints: a fork of the stopped process, kept frozen. restore()
+  // replaces the process with a fresh fork of the checkpoint, which stays
+  // available for further restores. Only the thread being traced is copied.
+  // Debug info and breakpoints are shared: the restored process gets the
+  // breakpoints set at the time of restore. Tracepoints are restored as they
+  // were at the checkpoint; allocation tracking is not rewound. An exec drops
+  // the checkpoints, they run the previous executable.
+  checkpoint_id checkpoint();
+  void restore(checkpoint_id id);
+  void dropCheckpoint(checkpoint_id id);
+
   // process state
   const Registers &registers() const { return _recentState.registers; }
   std::optional<SourceLocation> currentSourceLocation() const;
+  // call stack of the stopped process, as IPs starting with the current one
+  std::vector<addr_t> backtrace(std::size_t maxFrames = 64);
+  const ProcessDebugInfo &debugInfo() const { return _debugInfo; }
+  // Values of the locals and parameters of the current function, where their
+  // locations are known at the IP. The locations are computed from the
+  // registers by the expressions compiled with the debug info, and all the
+  // variables in memory are read with one syscall.
+  std::vector<VariableValue> readLocals();
+  // Reads memory of the stopped process, less than `len` bytes if unreadable
+  // memory is reached. Pages read are cached until the process resumes, so
+  // inspecting a data structure costs a syscall per page, not per read.
+  std::vector<std::uint8_t> readMemory(addr_t addr, std::size_t len);
+  const MemoryCache::Stats &memoryCacheStats() const {
+    return _memoryCache.stats();
+  }
+  // latencies of the phases of handling stops, and counters of the monitor's
+  // own work, to find where its time goes
+  MonitorStats stats() const;
+  // Snapshot of the writable memory of the stopped process. Updating it
+  // later returns the pages changed in between, see Snapshot.
+  Snapshot takeSnapshot();
+  std::vector<Snapshot::PageChange> updateSnapshot(Snapshot &snapshot);
+  // nullptr unless started with RunOptions::trackAllocations
+  AllocTracker *allocTracker() const { return _allocTracker.get(); }
 
 private:
   struct Breakpoint {
-    addr_t addr;
-    std::uint64_t originalData;
     breakpoint_id id;
+    // persistent breakpoints stay armed after a hit
+    bool persistent = false;
+  };
+
+  // the trap at an address, shared by the breakpoints there
+  struct BreakpointSite {
+    std::uint8_t originalByte;
+    std::vector<Breakpoint> breakpoints; // in the order they were added
   };
 
-  Monitor(int pid, const std::string &executable);
+  // ids of breakpoints used internally by the monitor
+  static constexpr breakpoint_id firstInternalBreakpointId = 1ull << 63;
+
+  struct BreakpointFilter {
+    BreakCondition condition;
+    std::uint64_t ignoreCount = 0;
+    std::uint64_t hits = 0;
+  };
+
+  struct ReturnBreakpoint {
+    breakpoint_id id;
+    unsigned activeCalls = 0;
+  };
+
+  struct Tracepoint {
+    addr_t addr;
+    std::vector<std::uint8_t> originalCode; // empty once removed
+  };
+
+  // memory for trampolines, allocated in the process
+  struct CodeArea {
+    addr_t start;
+    std::size_t used = 0;
+  };
+
+  struct Checkpoint {
+    int pid;
+    int pendingSignal;
+    // breakpoint traps in its code, with the original bytes
+    std::unordered_map<addr_t, std::uint8_t> traps;
+    addr_t tracepointRingAddr;
+    std::vector<Tracepoint> tracepoints;
+    std::vector<CodeArea> codeAreas;
+    std::unordered_map<addr_t, int> watchedPages;
+    bool watchFilterInstalled;
+  };
+
+  struct WatchedRegion {
+    watchpoint_id id;
+    addr_t addr;
+    std::size_t len;
+  };
+
+  Monitor(int pid, const std::string &executable,
+          ProcessDebugInfo::FileDebugInfoFuture debugInfo,
+          std::unique_ptr<AllocTracker> allocTracker,
+          long tracingOptions = 0, std::vector<long> tracedSyscalls = {});
+  Monitor(const ChildProcess &child, const std::string &executable);
 
   StopState wait();
-  void addBreakpoint(addr_t addr, breakpoint_id bid);
-  void disarmBreakpoint(const Breakpoint &bp);
+  // nullopt for a breakpoint hit filtered out by its condition
+  std::optional<StopState> processStop(int wstatus);
+  // counts the hit, returns true if the process should stop at it
+  bool filterBreakpointHit(breakpoint_id bid, const Registers &registers);
+  // Finishes the syscall stopped at by seccomp, returns it with the result.
+  // `child` is set if the syscall forked.
+  SyscallInfo completeSyscall(const ::user_regs_struct &entryRegs,
+                              std::optional<ChildProcess> &child);
+  // Prepares the child stopped at its start for another tracer, see
+  // ChildProcess. A vfork child is run until it execs first, nullopt if it
+  // exits before.
+  std::optional<ChildProcess> detachChild(int pid, bool sharesMemory);
+  // after exec: the debug info of the new executable, and the breakpoints
+  // at functions set again in the new memory
+  void reloadExecutable();
+  // nothing set if the function is not in the executable
+  void setFunctionBreakpoint(breakpoint_id bid, const std::string &function);
+  void resume(__ptrace_request request);
+  // stops the running process asynchronously, the stop is reported as SIGSTOP
+  void interrupt();
+  bool isInterruptStop(int wstatus) const;
+  void addBreakpoint(addr_t addr, breakpoint_id bid, bool persistent = false);
+  // adds many at once, the traps patched in address order
+  void addBreakpoints(std::span<const std::pair<addr_t, breakpoint_id>> bps,
+                      bool persistent = false);
+  // the breakpoint with the id at the address, the trap with the last one
+  void removeBreakpoint(addr_t addr, breakpoint_id bid);
+  void armBreakpoint(addr_t addr);
+  void disarmBreakpoint(addr_t addr, const BreakpointSite &site);
+  // replaces one byte of code, returns the previous value
+  std::uint8_t patchByte(addr_t addr, std::uint8_t value);
+  // replaces the first byte at each of the sorted addresses, returns the
+  // previous values. Bytes within a word are written at once.
+  std::vector<std::uint8_t> patchBytes(std::span<const addr_t> addrs,
+                                       std::uint8_t value);
+  // if stopped at a persistent breakpoint, executes the original instruction.
+  // Returns the stop state of the step.
+  std::optional<StopState> stepOverBreakpoint();
+  // Single-steps a copy of the original instruction in a scratch slot, the
+  // trap stays in place; branches are emulated instead. Returns nullopt if
+  // the instruction can't be moved nor emulated, like int3 or iret.
+  std::optional<StopState> stepDisplaced(addr_t addr);
+  // Does the branch at `addr` on the registers and stack of the process.
+  // Returns nullopt if its memory operands can't be accessed.
+  std::optional<StopState> emulateBranch(addr_t addr, const Branch &branch);
+  // slot for a copy of the instruction at `addr`, within a rel32 of it
+  addr_t displacedStepSlot(addr_t addr);
+  // Executes the write which faulted on a watched page, with the page
+  // writable for the step. Returns the stop state of the step.
+  std::optional<StopState> stepOverWatchFault();
+  // makes the syscalls writing into memory stop the process, once
+  void installWatchFilter();
+  // watched pages the syscall at its seccomp stop may write into, sorted
+  std::vector<addr_t> watchedPagesWritten(const ::user_regs_struct &regs);
+  // From the seccomp stop, makes the syscall again with the pages writable,
+  // stopping at it again. False if it can't be made again.
+  bool restartWithPagesWritable(::user_regs_struct regs,
+                                std::span<const addr_t> pages);
+  // Sets the protection of the pages, sorted, to the one in `protections`,
+  // without PROT_WRITE unless `writable`. An mprotect per run of pages.
+  void protectPages(int pid, std::span<const addr_t> pages,
+                    const std::unordered_map<addr_t, int> &protections,
+                    bool writable);
+  // like stepOverBreakpoint(), but returns the stop state only if the step
+  // stopped for a reason other than the step itself
+  std::optional<StopState> leaveBreakpoint();
+  void onCallEntry(const std::string &function, CallTrace &trace);
+  void onCallReturn(std::unordered_map<addr_t, ReturnBreakpoint>::iterator it,
+                    CallTrace &trace);
 
   // prints memory at address
   void dumpMem(addr_t addr, size_t len);
+  // writes to any mapped memory, including read-only code
+  void writeMemory(addr_t addr, std::span<const std::uint8_t> data);
+  // like above, in another stopped process traced by the monitor
+  void writeMemory(int pid, addr_t addr, std::span<const std::uint8_t> data);
+
+  // Makes the stopped process execute a syscall at its current IP, returns
+  // the result. The process state is restored after.
+  long injectSyscall(long number, std::initializer_list<std::uint64_t> args);
+  // like above, in another stopped process traced by the monitor
+  long injectSyscall(int pid, long number,
+                     std::initializer_list<std::uint64_t> args);
+  // Forks the stopped process with an injected syscall. Returns the pid of
+  // the copy, stopped and traced, in the same state as the original.
+  int forkProcess(int pid);
+  void killProcess(int pid);
+  // once the process restored from a checkpoint is gone, lets the checkpoint
+  // reap it
+  void reapRestoredProcess();
+  void mapTracepointRing();
+  // returns `size` bytes of memory for code, within a rel32 jump from `near`
+  addr_t allocateTrampoline(addr_t near, std::size_t size);
+
+  std::vector<addr_t> unwindStack(std::size_t maxFrames);
+
+  // ::ptrace, counted in the stats
+  template <typename... Args>
+  long ptrace(__ptrace_request request, int pid, Args... args) {
+    ++_stats.ptraceCalls;
+    return ::ptrace(request, pid, args...);
+  }
 
   int _childPid = 0;
   std::string _executable;
+  long _tracingOptions = 0; // beyond those of all processes, see RunOptions
+  std::vector<long> _tracedSyscalls; // reported as StopReason::Syscall
   bool _running = false;
+  int _pendingSignal = 0; // to be delivered on next resume
+  bool _interruptRequested = false;
+  __ptrace_request _lastResumeRequest = PTRACE_CONT;
+
+  std::unordered_map<addr_t, BreakpointSite> _breakpoints;
+  breakpoint_id _nextInternalBreakpointId = firstInternalBreakpointId;
+  std::unordered_map<breakpoint_id, BreakpointFilter> _breakpointFilters;
+  // set by breakAtFunction(), including those not in the executable
+  std::unordered_map<breakpoint_id, std::string> _breakpointFunctions;
 
-  std::vector<Breakpoint> _breakpoints;
+  // call tracing
+  std::unordered_map<breakpoint_id, std::string> _tracedFunctions;
+  std::unordered_map<addr_t, ReturnBreakpoint> _returnBreakpoints;
+  // line coverage, lines starting at each breakpoint not hit yet
+  bool _coverageArmed = false;
+  std::unordered_map<breakpoint_id, std::vector<SourceLocation>>
+      _coverageBreakpoints;
   ProcessDebugInfo _debugInfo;
+  Unwinder _unwinder;
+  std::vector<std::uint8_t> _stackCopy; // reused between backtraces
+  MemoryCache _memoryCache;
+  std::unique_ptr<AllocTracker> _allocTracker;
+
+  // fast tracepoints
+  std::unique_ptr<TracepointRing> _tracepointRing;
+  addr_t _tracepointRingAddr = 0; // in the process
+  std::vector<Tracepoint> _tracepoints; // by id
+  std::vector<CodeArea> _codeAreas;
+
+  // scratch code for displaced stepping, in the code areas
+  struct DisplacedStepSlot {
+    addr_t addr;
+    addr_t instruction = 0; // address of the instruction copied there
+  };
+  std::vector<DisplacedStepSlot> _displacedStepSlots;
+
+  // software watchpoints, with the original protection of their pages
+  std::vector<WatchedRegion> _watchedRegions;
+  watchpoint_id _nextWatchpointId = 1;
+  std::unordered_map<addr_t, int> _watchedPages;
+  // page of the write fault stopped at, written on resume
+  std::optional<addr_t> _watchFaultPage;
+  bool _watchFilterInstalled = false;
+  // a syscall made again with the watched pages it writes writable, with
+  // the contents of the regions in them before
+  struct WatchedBytes {
+    watchpoint_id id;
+    addr_t addr;
+    std::vector<std::uint8_t> data;
+  };
+  struct WatchedSyscall {
+    std::vector<addr_t> pages;
+    std::vector<WatchedBytes> before;
+  };
+  std::optional<WatchedSyscall> _watchedSyscall;
+
+  std::unordered_map<checkpoint_id, Checkpoint> _checkpoints;
+  checkpoint_id _nextCheckpointId = 1;
+  int _restoredFrom = 0; // pid of the checkpoint the process is forked from
 
   struct {
     Registers registers;
   } _recentState;
+
+  // mutable, for timing the const lookups
+  mutable MonitorStats _stats;
 };
 
 } // namespace Whiteboard
\ No newline at end of file
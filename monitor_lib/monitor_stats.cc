@@ -0,0 +1,43 @@
+#include "monitor_stats.hh"
+
+namespace Whiteboard {
+
+std::uint64_t LatencyHistogram::percentileTicks(double fraction) const {
+  std::uint64_t target = fraction * _count;
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < numBuckets; ++i) {
+    seen += _buckets[i];
+    if (seen > target || (seen == _count && seen > 0))
+      return i == 0 ? 0 : std::min(_maxTicks, (std::uint64_t(1) << i) - 1);
+  }
+  return 0;
+}
+
+const char *MonitorStats::phaseName(Phase phase) {
+  switch (phase) {
+  case Phase::Wait:
+    return "wait";
+  case Phase::GetRegisters:
+    return "get registers";
+  case Phase::BreakpointLookup:
+    return "breakpoint lookup";
+  case Phase::Symbolize:
+    return "symbolize";
+  case Phase::Resume:
+    return "resume";
+  }
+  return "?";
+}
+
+MonitorStats::MonitorStats()
+    : _startTicks(__rdtsc()), _startTime(std::chrono::steady_clock::now()) {}
+
+double MonitorStats::ticksPerMicrosecond() const {
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - _startTime;
+  if (elapsed.count() <= 0)
+    return 1;
+  return (__rdtsc() - _startTicks) / elapsed.count();
+}
+
+} // namespace Whiteboard
\ No newline at end of file
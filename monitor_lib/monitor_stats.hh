@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+#include <x86intrin.h>
+
+namespace Whiteboard {
+
+// Histogram of latencies in TSC ticks, in power-of-two buckets. Recording is
+// a few instructions, cheap enough to be done on every stop.
+class LatencyHistogram {
+public:
+  // bucket i holds latencies in [2^(i-1), 2^i), bucket 0 zeros
+  static constexpr std::size_t numBuckets = 64;
+
+  void record(std::uint64_t ticks) {
+    ++_buckets[std::min<std::size_t>(std::bit_width(ticks), numBuckets - 1)];
+    ++_count;
+    _totalTicks += ticks;
+    _maxTicks = std::max(_maxTicks, ticks);
+  }
+
+  std::uint64_t count() const { return _count; }
+  std::uint64_t totalTicks() const { return _totalTicks; }
+  std::uint64_t maxTicks() const { return _maxTicks; }
+  // Upper bound of the bucket reaching the given fraction of the latencies,
+  // e.g. 0.99 for the 99th percentile. Exact within a factor of 2.
+  std::uint64_t percentileTicks(double fraction) const;
+
+private:
+  std::array<std::uint64_t, numBuckets> _buckets{};
+  std::uint64_t _count = 0;
+  std::uint64_t _totalTicks = 0;
+  std::uint64_t _maxTicks = 0;
+};
+
+// Records the time until the end of the scope
+class ScopedLatency {
+public:
+  explicit ScopedLatency(LatencyHistogram &histogram)
+      : _histogram(histogram), _start(__rdtsc()) {}
+  ~ScopedLatency() { _histogram.record(__rdtsc() - _start); }
+
+  ScopedLatency(const ScopedLatency &) = delete;
+  ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+private:
+  LatencyHistogram &_histogram;
+  std::uint64_t _start;
+};
+
+// Where the monitor spends its time, see Monitor::stats()
+struct MonitorStats {
+  // parts of handling a stop, timed separately
+  enum class Phase {
+    Wait,             // waitpid, until the process stops
+    GetRegisters,     // of the stopped process
+    BreakpointLookup, // including the conditions
+    Symbolize,        // address to source location
+    Resume,           // the ptrace call resuming the process
+  };
+  static constexpr std::size_t numPhases = 5;
+  static const char *phaseName(Phase phase);
+
+  MonitorStats();
+
+  LatencyHistogram &phase(Phase p) { return phases[std::size_t(p)]; }
+  const LatencyHistogram &phase(Phase p) const {
+    return phases[std::size_t(p)];
+  }
+
+  // TSC frequency, measured over the lifetime of the stats
+  double ticksPerMicrosecond() const;
+
+  std::array<LatencyHistogram, numPhases> phases;
+
+  // counted by Monitor::StopReason, including the internal stops, like
+  // stepping over breakpoints
+  static constexpr std::size_t numStopReasons = 7;
+  std::array<std::uint64_t, numStopReasons> stops{};
+  // traps at breakpoints, including the hits filtered out by conditions
+  std::uint64_t breakpointHits = 0;
+  std::uint64_t filteredHits = 0;
+  std::uint64_t ptraceCalls = 0;
+  // from the memory of the process, other than by ptrace
+  std::uint64_t bytesRead = 0;
+
+private:
+  std::uint64_t _startTicks;
+  std::chrono::steady_clock::time_point _startTime;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "perf_map.hh"
+
+#include "logging.hh"
+
+#include <fmt/core.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string_view>
+
+namespace Whiteboard {
+
+namespace {
+
+// jitdump format, as specified in the perf sources
+// (tools/perf/Documentation/jitdump-specification.txt)
+constexpr std::uint32_t jitDumpMagic = 0x4A695444; // "JiTD"
+
+struct JitHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t totalSize;
+  std::uint32_t elfMach;
+  std::uint32_t pad1;
+  std::uint32_t pid;
+  std::uint64_t timestamp;
+  std::uint64_t flags;
+};
+
+struct JitRecordHeader {
+  std::uint32_t id;
+  std::uint32_t totalSize;
+  std::uint64_t timestamp;
+};
+
+enum JitRecordId : std::uint32_t {
+  JitCodeLoad = 0,
+  JitCodeMove = 1,
+};
+
+// followed by the name, null-terminated, and the code
+struct JitCodeLoadRecord {
+  std::uint32_t pid;
+  std::uint32_t tid;
+  std::uint64_t vma;
+  std::uint64_t codeAddr;
+  std::uint64_t codeSize;
+  std::uint64_t codeIndex;
+};
+
+struct JitCodeMoveRecord {
+  std::uint32_t pid;
+  std::uint32_t tid;
+  std::uint64_t vma;
+  std::uint64_t oldCodeAddr;
+  std::uint64_t newCodeAddr;
+  std::uint64_t codeSize;
+  std::uint64_t codeIndex;
+};
+
+template <typename T> bool readStruct(std::ifstream &f, T &out) {
+  return bool(f.read(reinterpret_cast<char *>(&out), sizeof(T)));
+}
+
+} // namespace
+
+PerfMap::PerfMap(int pid)
+    : _pid(pid), _perfMap{fmt::format("/tmp/perf-{}.map", pid)} {}
+
+std::optional<std::string> PerfMap::findFunctionName(addr_t addr,
+                                                     const MemMaps &maps) {
+  const Symbol *symbol = find(addr);
+  if (!symbol && refresh(maps))
+    symbol = find(addr);
+  if (!symbol)
+    return std::nullopt;
+  return symbol->name;
+}
+
+bool PerfMap::refresh(const MemMaps &maps) {
+  auto now = std::chrono::steady_clock::now();
+  if (_jitDump.path.empty() &&
+      now - _lastJitDumpSearch >= jitDumpSearchInterval) {
+    _lastJitDumpSearch = now;
+    // the JIT maps the file to announce it to perf; if mapped after the maps
+    // were read, it's looked for where perf map files are
+    std::string name = fmt::format("jit-{}.dump", _pid);
+    for (const MemMaps::Mapping &mapping : maps.mappings()) {
+      if (std::filesystem::path(mapping.path).filename() == name) {
+        _jitDump.path = mapping.path;
+        break;
+      }
+    }
+    std::error_code ec;
+    if (_jitDump.path.empty() && std::filesystem::exists("/tmp/" + name, ec))
+      _jitDump.path = "/tmp/" + name;
+  }
+
+  // symbols read are added with the next generation
+  ++_generation;
+  std::size_t added = readPerfMap();
+  if (!_jitDump.path.empty())
+    added += readJitDump();
+  if (added == 0) {
+    --_generation;
+    return false;
+  }
+  Logging::debug("PerfMap: {} symbols of process {}, generation {}",
+                 _symbols.size(), _pid, _generation);
+  return true;
+}
+
+void PerfMap::add(addr_t start, addr_t end, std::string name) {
+  if (start >= end)
+    return;
+
+  // older symbols are cut to the parts not overlapped
+  auto it = _symbols.lower_bound(start);
+  if (it != _symbols.begin()) {
+    auto previous = std::prev(it);
+    Symbol &older = previous->second;
+    if (older.end > end)
+      _symbols.emplace(end, Symbol{older.end, older.generation, older.name});
+    if (older.end > start)
+      older.end = start;
+  }
+  while (it != _symbols.end() && it->first < end) {
+    if (it->second.end > end) {
+      Symbol rest = std::move(it->second);
+      _symbols.erase(it);
+      _symbols.emplace(end, std::move(rest));
+      break;
+    }
+    it = _symbols.erase(it);
+  }
+
+  _symbols.emplace(start, Symbol{end, _generation, std::move(name)});
+}
+
+const PerfMap::Symbol *PerfMap::find(addr_t addr) const {
+  auto it = _symbols.upper_bound(addr);
+  if (it == _symbols.begin())
+    return nullptr;
+  --it;
+  if (addr >= it->second.end)
+    return nullptr;
+  return &it->second;
+}
+
+std::size_t PerfMap::readPerfMap() {
+  std::error_code ec;
+  std::uint64_t size = std::filesystem::file_size(_perfMap.path, ec);
+  if (ec || size <= _perfMap.offset)
+    return 0;
+
+  std::ifstream f(_perfMap.path, std::ios::binary);
+  f.seekg(_perfMap.offset);
+  std::string appended(size - _perfMap.offset, '\0');
+  f.read(appended.data(), appended.size());
+  appended.resize(f.gcount());
+
+  // complete lines only, the rest is read with the next refresh:
+  // "<start> <size> <name>", the numbers in hex
+  std::string_view text = appended;
+  std::size_t added = 0;
+  std::size_t lineEnd;
+  while ((lineEnd = text.find('\n')) != std::string_view::npos) {
+    std::string line(text.substr(0, lineEnd));
+    text.remove_prefix(lineEnd + 1);
+    _perfMap.offset += lineEnd + 1;
+
+    char *next = nullptr;
+    addr_t start = std::strtoull(line.c_str(), &next, 16);
+    std::uint64_t length = std::strtoull(next, &next, 16);
+    if (*next != ' ') {
+      Logging::trace("PerfMap: skipping line: {}", line);
+      continue;
+    }
+    add(start, start + length, std::string(next + 1));
+    ++added;
+  }
+  return added;
+}
+
+std::size_t PerfMap::readJitDump() {
+  std::error_code ec;
+  std::uint64_t size = std::filesystem::file_size(_jitDump.path, ec);
+  if (ec || size <= _jitDump.offset)
+    return 0;
+
+  std::ifstream f(_jitDump.path, std::ios::binary);
+  if (_jitDump.offset == 0) {
+    JitHeader header;
+    if (!readStruct(f, header) || header.totalSize < sizeof(header))
+      return 0;
+    if (header.magic != jitDumpMagic) {
+      // of a process with the other byte order, or not a jitdump at all
+      Logging::error("PerfMap: unsupported jitdump file {}", _jitDump.path);
+      _jitDump.offset = size;
+      return 0;
+    }
+    _jitDump.offset = header.totalSize;
+  }
+
+  // records of code loaded and moved; the code itself is skipped
+  std::size_t added = 0;
+  JitRecordHeader record;
+  while (f.seekg(_jitDump.offset) && readStruct(f, record) &&
+         record.totalSize >= sizeof(record) &&
+         _jitDump.offset + record.totalSize <= size) {
+    if (record.id == JitCodeLoad) {
+      JitCodeLoadRecord load;
+      std::uint64_t fixed = sizeof(record) + sizeof(load);
+      if (!readStruct(f, load) || record.totalSize < fixed + load.codeSize)
+        break;
+      std::string name(record.totalSize - fixed - load.codeSize, '\0');
+      f.read(name.data(), name.size());
+      add(load.codeAddr, load.codeAddr + load.codeSize, name.c_str());
+      ++added;
+    } else if (record.id == JitCodeMove) {
+      JitCodeMoveRecord move;
+      if (!readStruct(f, move))
+        break;
+      if (const Symbol *moved = find(move.oldCodeAddr)) {
+        add(move.newCodeAddr, move.newCodeAddr + move.codeSize, moved->name);
+        ++added;
+      }
+    }
+    _jitDump.offset += record.totalSize;
+  }
+  return added;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
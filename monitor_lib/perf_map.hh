@@ -0,0 +1,71 @@
+#pragma once
+
+#include "mem_maps.hh"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+
+// Symbols of code generated at run time, from the files JIT compilers write
+// for perf: /tmp/perf-<pid>.map, a line per function, and jitdump files. The
+// files are append-only, each refresh() reads just what was appended since
+// the previous one.
+//
+// The symbols are kept as non-overlapping ranges. Code can be generated
+// again at the same addresses, so a newer symbol replaces the parts of the
+// older ones it overlaps.
+class PerfMap {
+public:
+  explicit PerfMap(int pid);
+
+  // Name of the symbol containing the address. If there's none, the files
+  // are refreshed first, the code may have been generated since.
+  std::optional<std::string> findFunctionName(addr_t addr,
+                                              const MemMaps &maps);
+
+  // Reads the lines and records appended to the files, returns true if
+  // symbols were added. The jitdump file is the one mapped by the process,
+  // looked for at most once per jitDumpSearchInterval until found; else a
+  // refresh only checks the size of the files.
+  bool refresh(const MemMaps &maps);
+  static constexpr std::chrono::milliseconds jitDumpSearchInterval{100};
+
+  // incremented by each refresh adding symbols; a name found stays valid
+  // until it changes
+  std::uint64_t generation() const { return _generation; }
+  std::size_t size() const { return _symbols.size(); }
+
+private:
+  struct Symbol {
+    addr_t end;
+    std::uint64_t generation; // of the refresh adding it
+    std::string name;
+  };
+
+  // a file read up to `offset`
+  struct TailedFile {
+    std::string path;
+    std::uint64_t offset = 0;
+  };
+
+  void add(addr_t start, addr_t end, std::string name);
+  const Symbol *find(addr_t addr) const;
+  // return the number of symbols read
+  std::size_t readPerfMap();
+  std::size_t readJitDump();
+
+  int _pid;
+  TailedFile _perfMap;
+  TailedFile _jitDump; // path empty until found
+  std::chrono::steady_clock::time_point _lastJitDumpSearch;
+  std::map<addr_t, Symbol> _symbols; // by start address
+  std::uint64_t _generation = 0;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
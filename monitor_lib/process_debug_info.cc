@@ -2,15 +2,114 @@
 
 #include "logging.hh"
 
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
 namespace Whiteboard {
-ProcessDebugInfo::ProcessDebugInfo(int pid, const std::string &executablePath)
-    : _executable(executablePath), _executableDebugInfo(executablePath) {
+
+namespace {
+
+// Images of the files loaded, shared by all processes of the monitor. An
+// image is loaded again only if the file was modified since.
+struct LoadedFile {
+  std::filesystem::file_time_type modified;
+  ProcessDebugInfo::FileDebugInfoFuture debugInfo;
+  std::shared_ptr<const ElfFile> symbols;
+};
+
+std::mutex g_loadedFilesMutex;
+std::unordered_map<std::string, LoadedFile> g_loadedFiles; // by path
+// DWARF by build-id, shared by the copies of a file at different paths
+std::unordered_map<std::string, ProcessDebugInfo::FileDebugInfoFuture>
+    g_debugInfoByBuildId;
+
+// to be called with the mutex locked
+LoadedFile &loadedFile(const std::string &path) {
+  std::error_code ec;
+  auto modified = std::filesystem::last_write_time(path, ec);
+  LoadedFile &file = g_loadedFiles[path];
+  if (file.modified != modified)
+    file = LoadedFile{modified};
+  return file;
+}
+
+// to be called with the mutex locked; small enough to be loaded under it
+const std::shared_ptr<const ElfFile> &symbols(LoadedFile &file,
+                                              const std::string &path) {
+  if (!file.symbols)
+    file.symbols = std::make_shared<const ElfFile>(path);
+  return file.symbols;
+}
+
+std::shared_ptr<const ElfFile> loadSymbols(const std::string &path) {
+  std::lock_guard lock(g_loadedFilesMutex);
+  return symbols(loadedFile(path), path);
+}
+
+// where JIT compilers put code: anonymous memory, possibly named, or a
+// memfd. Not [stack], [vdso] and the like.
+bool mayHoldJitCode(const std::string &path) {
+  return path.empty() || path.starts_with("[anon:") ||
+         path.starts_with("/memfd:") || path.starts_with("memfd:");
+}
+
+} // namespace
+
+ProcessDebugInfo::FileDebugInfoFuture
+ProcessDebugInfo::loadAsync(const std::string &path) {
+  std::lock_guard lock(g_loadedFilesMutex);
+  LoadedFile &file = loadedFile(path);
+  if (file.debugInfo.valid())
+    return file.debugInfo;
+
+  // the file may be a copy of one loaded already; if it's not ELF, loading
+  // DWARF fails too, when waited for
+  std::string buildId;
+  try {
+    buildId = symbols(file, path)->buildId();
+  } catch (const std::runtime_error &) {
+  }
+  if (auto it = g_debugInfoByBuildId.find(buildId);
+      !buildId.empty() && it != g_debugInfoByBuildId.end()) {
+    Logging::debug("ProcessDebugInfo: debug info of {} shared by build-id {}",
+                   path, buildId);
+    file.debugInfo = it->second;
+    return file.debugInfo;
+  }
+
+  auto load = [path] {
+    auto start = std::chrono::steady_clock::now();
+    auto debugInfo = std::make_shared<const FileDebugInfo>(path);
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    Logging::debug("ProcessDebugInfo: loaded debug info of {} in {:.1f} ms",
+                   path, elapsed.count());
+    return debugInfo;
+  };
+  file.debugInfo = std::async(std::launch::async, load).share();
+  if (!buildId.empty())
+    g_debugInfoByBuildId.emplace(buildId, file.debugInfo);
+  return file.debugInfo;
+}
+
+ProcessDebugInfo::ProcessDebugInfo(int pid, const std::string &executablePath,
+                                   FileDebugInfoFuture executableDebugInfo)
+    : _executable(executablePath),
+      _executableSymbols(loadSymbols(executablePath)),
+      _executableDebugInfo(std::move(executableDebugInfo)), _perfMap(pid) {
   _maps.load(pid);
 }
 
+void ProcessDebugInfo::reloadMaps(int pid) { _maps.load(pid); }
+
 addr_t ProcessDebugInfo::findFunction(const std::string &fname) const {
-  auto offset = _executableDebugInfo.findFunction(fname);
-  return _maps.findAddressByOffset(_executable, offset);
+  // plain names like main are in the symbol table, no need to wait for DWARF
+  std::optional<offset_t> offset = _executableSymbols->findFunction(fname);
+  if (!offset)
+    offset = executableDebugInfo().findFunction(fname);
+  return _maps.findAddressByOffset(_executable, *offset);
 }
 
 std::optional<SourceLocation>
@@ -27,7 +126,62 @@ ProcessDebugInfo::findSourceLocation(addr_t addr) const {
   if (path != _executable)
     return std::nullopt;
 
-  return _executableDebugInfo.findSourceLocation(offset);
+  return executableDebugInfo().findSourceLocation(offset);
+}
+
+std::optional<std::string>
+ProcessDebugInfo::findFunctionName(addr_t addr) const {
+
+  // JIT code may also be mapped after the maps were read
+  auto maybeMapping = _maps.tryFindFileAndOffsetByAddress(addr);
+  if (!maybeMapping || mayHoldJitCode(std::get<0>(*maybeMapping)))
+    return _perfMap.findFunctionName(addr, _maps);
+
+  auto [path, offset] = *maybeMapping;
+  if (path != _executable)
+    return std::nullopt;
+
+  // DWARF is needed only for functions without symbols
+  if (auto name = _executableSymbols->findFunctionName(offset))
+    return name;
+  return executableDebugInfo().findFunctionName(offset);
+}
+
+std::optional<ProcessDebugInfo::FunctionScope>
+ProcessDebugInfo::findFunctionScope(addr_t addr) const {
+
+  auto maybeMapping = _maps.tryFindFileAndOffsetByAddress(addr);
+  if (!maybeMapping)
+    return std::nullopt;
+
+  auto [path, offset] = *maybeMapping;
+  if (path != _executable)
+    return std::nullopt;
+
+  const FileDebugInfo::FunctionRange *function =
+      executableDebugInfo().findFunctionRange(offset);
+  if (!function)
+    return std::nullopt;
+  return FunctionScope{function, offset, addr - offset};
+}
+
+std::vector<std::pair<addr_t, SourceLocation>>
+ProcessDebugInfo::executableStatements() const {
+  auto statements = executableDebugInfo().statements();
+  std::vector<std::pair<addr_t, SourceLocation>> out;
+  out.reserve(statements.size());
+  for (auto &[offset, location] : statements)
+    out.emplace_back(_maps.findAddressByOffset(_executable, offset),
+                     std::move(location));
+  return out;
+}
+
+std::vector<addr_t>
+ProcessDebugInfo::findLineAddresses(const std::string &file, int line) const {
+  std::vector<addr_t> out;
+  for (offset_t offset : executableDebugInfo().findStatements(file, line))
+    out.push_back(_maps.findAddressByOffset(_executable, offset));
+  return out;
 }
 
 } // namespace Whiteboard
\ No newline at end of file
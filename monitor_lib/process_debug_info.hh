@@ -1,11 +1,17 @@
 #pragma once
 
+#include "elf_file.hh"
 #include "file_debug_info.hh"
 #include "mem_maps.hh"
+#include "perf_map.hh"
 #include "source_location.hh"
 
+#include <future>
+#include <memory>
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace Whiteboard {
 
@@ -13,17 +19,61 @@ using addr_t = std::uint64_t;
 
 // Keeps debug info for a running process.
 // Allows for translating symbols <-> process-space addresses
+//
+// The debug info of a file is an immutable image, loaded once and shared by
+// all processes running it, even on different threads. What's per process
+// are the memory maps, relocating the offsets of the image to addresses, and
+// the symbols of code generated at run time, see PerfMap.
 class ProcessDebugInfo {
 public:
-  ProcessDebugInfo(int pid, const std::string &executablePath);
+  using FileDebugInfoFuture =
+      std::shared_future<std::shared_ptr<const FileDebugInfo>>;
+
+  // Starts loading DWARF of the file on a background thread, unless it's
+  // loaded already, from this path or another with the same build-id.
+  // Thread-safe.
+  static FileDebugInfoFuture loadAsync(const std::string &path);
+
+  // function of the executable, with its variables
+  struct FunctionScope {
+    const FileDebugInfo::FunctionRange *function;
+    offset_t offset; // of the address looked up, in the executable
+    addr_t loadBias; // address - offset, for DW_OP_addr locations
+  };
+
+  // DWARF of the executable is waited for only by the lookups needing it:
+  // functions are found by the ELF symbols, the source lines by DWARF.
+  ProcessDebugInfo(int pid, const std::string &executablePath,
+                   FileDebugInfoFuture executableDebugInfo);
 
   addr_t findFunction(const std::string &fname) const;
   std::optional<SourceLocation> findSourceLocation(addr_t addr) const;
+  // JIT code, outside of file mappings, is found in the perf map files
+  std::optional<std::string> findFunctionName(addr_t addr) const;
+  std::optional<FunctionScope> findFunctionScope(addr_t addr) const;
+  // beginnings of statements in the executable, see FileDebugInfo
+  std::vector<std::pair<addr_t, SourceLocation>> executableStatements() const;
+  // beginnings of the statements of a source line in the executable, sorted,
+  // the file matched by suffix, see FileDebugInfo::findStatements()
+  std::vector<addr_t> findLineAddresses(const std::string &file,
+                                        int line) const;
+
+  const MemMaps &maps() const { return _maps; }
+  // re-reads the maps, to pick up libraries loaded since
+  void reloadMaps(int pid);
 
 private:
+  // blocks until loaded
+  const FileDebugInfo &executableDebugInfo() const {
+    return *_executableDebugInfo.get();
+  }
+
   std::string _executable;
-  FileDebugInfo _executableDebugInfo;
+  std::shared_ptr<const ElfFile> _executableSymbols;
+  FileDebugInfoFuture _executableDebugInfo;
   MemMaps _maps;
+  // refreshed by the lookups
+  mutable PerfMap _perfMap;
 };
 
 } // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "profile.hh"
+
+#include <algorithm>
+#include <map>
+
+namespace Whiteboard {
+
+namespace {
+
+template <typename Key>
+std::vector<Profile::Bucket<Key>>
+toSortedBuckets(const std::map<Key, Profile::Bucket<Key>> &histogram) {
+  std::vector<Profile::Bucket<Key>> buckets;
+  buckets.reserve(histogram.size());
+  for (const auto &[key, bucket] : histogram)
+    buckets.push_back(bucket);
+
+  std::ranges::stable_sort(buckets, std::ranges::greater{},
+                           &Profile::Bucket<Key>::samples);
+  return buckets;
+}
+
+} // namespace
+
+void Profile::addSample(addr_t ip, addr_t sp) {
+  ++_samples;
+  IpSamples &samples = _ipHistogram[ip];
+  ++samples.samples;
+  samples.lowestSp = std::min(samples.lowestSp, sp);
+  _lowestSp = std::min(_lowestSp, sp);
+  _highestSp = std::max(_highestSp, sp);
+}
+
+Profile::Summary Profile::summarize(const ProcessDebugInfo &debugInfo) const {
+
+  std::map<SourceLocation, Bucket<SourceLocation>> lines;
+  std::map<std::string, Bucket<std::string>> functions;
+
+  Summary summary;
+  summary.totalSamples = _samples;
+  if (_samples > 0)
+    summary.stackDepth = _highestSp - _lowestSp;
+
+  auto add = [&](auto &histogram, const auto &key, const IpSamples &samples) {
+    auto [it, inserted] = histogram.try_emplace(key, key);
+    it->second.samples += samples.samples;
+    it->second.stackDepth =
+        std::max(it->second.stackDepth, _highestSp - samples.lowestSp);
+  };
+
+  for (const auto &[ip, samples] : _ipHistogram) {
+    auto maybeLocation = debugInfo.findSourceLocation(ip);
+    auto maybeFunction = debugInfo.findFunctionName(ip);
+
+    if (maybeLocation)
+      add(lines, *maybeLocation, samples);
+    if (maybeFunction)
+      add(functions, *maybeFunction, samples);
+    if (!maybeLocation && !maybeFunction)
+      summary.unresolvedSamples += samples.samples;
+  }
+
+  summary.lines = toSortedBuckets(lines);
+  summary.functions = toSortedBuckets(functions);
+  return summary;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "process_debug_info.hh"
+#include "source_location.hh"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+// Histogram of instruction pointer samples, collected by Monitor::sample.
+// Samples are stored per raw address, symbolization happens only when the
+// summary is requested, so that recording a sample is cheap. The stack
+// pointer of the samples tells how deep the stack was at each address.
+class Profile {
+public:
+  template <typename Key> struct Bucket {
+    Key key;
+    std::uint64_t samples = 0;
+    // deepest stack sampled, in bytes below the highest stack pointer of
+    // all the samples
+    std::uint64_t stackDepth = 0;
+  };
+
+  struct Summary {
+    std::uint64_t totalSamples = 0;
+    // samples with IP outside of the known debug info
+    std::uint64_t unresolvedSamples = 0;
+    // range of the stack pointers sampled
+    std::uint64_t stackDepth = 0;
+
+    // sorted by number of samples, descending
+    std::vector<Bucket<SourceLocation>> lines;
+    std::vector<Bucket<std::string>> functions;
+  };
+
+  void addSample(addr_t ip, addr_t sp);
+
+  std::uint64_t samples() const { return _samples; }
+
+  Summary summarize(const ProcessDebugInfo &debugInfo) const;
+
+private:
+  struct IpSamples {
+    std::uint64_t samples = 0;
+    addr_t lowestSp = ~addr_t(0);
+  };
+
+  std::uint64_t _samples = 0;
+  addr_t _lowestSp = ~addr_t(0);
+  addr_t _highestSp = 0;
+  std::unordered_map<addr_t, IpSamples> _ipHistogram;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -7,9 +7,23 @@ namespace Whiteboard {
 Registers Registers::fromLinux(const ::user_regs_struct &regs) {
 
   Registers out;
+  out[A].set64(regs.rax);
+  out[C].set64(regs.rcx);
+  out[D].set64(regs.rdx);
+  out[B].set64(regs.rbx);
+  out[SI].set64(regs.rsi);
+  out[DI].set64(regs.rdi);
   out[SP].set64(regs.rsp);
+  out[BP].set64(regs.rbp);
+  out[R8].set64(regs.r8);
+  out[R9].set64(regs.r9);
+  out[R10].set64(regs.r10);
+  out[R11].set64(regs.r11);
+  out[R12].set64(regs.r12);
+  out[R13].set64(regs.r13);
+  out[R14].set64(regs.r14);
+  out[R15].set64(regs.r15);
   out[IP].set64(regs.rip);
-  // TODO set others
   return out;
 }
 
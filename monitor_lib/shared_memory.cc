@@ -0,0 +1,43 @@
+#include "shared_memory.hh"
+
+#include <fmt/core.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Whiteboard {
+
+SharedMemory::SharedMemory(const std::string &name, std::size_t size)
+    : _size(size) {
+  _fd = ::memfd_create(name.c_str(), MFD_CLOEXEC);
+  if (_fd < 0) {
+    throw std::runtime_error(fmt::format(
+        "Failed to create shared memory '{}': {}", name, std::strerror(errno)));
+  }
+
+  if (::ftruncate(_fd, size) != 0) {
+    int error = errno;
+    ::close(_fd);
+    throw std::runtime_error(fmt::format("Failed to resize shared memory: {}",
+                                         std::strerror(error)));
+  }
+
+  _data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (_data == MAP_FAILED) {
+    int error = errno;
+    ::close(_fd);
+    throw std::runtime_error(fmt::format("Failed to map shared memory: {}",
+                                         std::strerror(error)));
+  }
+}
+
+SharedMemory::~SharedMemory() {
+  ::munmap(_data, _size);
+  ::close(_fd);
+}
+
+} // namespace Whiteboard
\ No newline at end of file
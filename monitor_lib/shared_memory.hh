@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Whiteboard {
+
+// Anonymous shared memory (memfd), mapped read-write. The fd can be
+// inherited by a child process, which maps it to share the memory.
+class SharedMemory {
+public:
+  SharedMemory(const std::string &name, std::size_t size);
+  SharedMemory(const SharedMemory &) = delete;
+  ~SharedMemory();
+
+  void *data() const { return _data; }
+  std::size_t size() const { return _size; }
+  // the fd is close-on-exec, it has to be cleared in the child that inherits it
+  int fd() const { return _fd; }
+
+private:
+  int _fd = -1;
+  void *_data = nullptr;
+  std::size_t _size = 0;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
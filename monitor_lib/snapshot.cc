@@ -0,0 +1,309 @@
+#include "snapshot.hh"
+
+#include "logging.hh"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace Whiteboard {
+
+namespace {
+
+constexpr std::uint64_t pagePresent = 1ull << 63;
+constexpr std::uint64_t pageSwapped = 1ull << 62;
+constexpr std::uint64_t pageSoftDirty = 1ull << 55;
+
+constexpr std::size_t maxIovecs = 1024;    // IOV_MAX
+constexpr std::size_t pagemapChunk = 4096; // entries read at once
+
+bool isTracked(const MemMaps::Mapping &mapping) {
+  return mapping.readable() && mapping.writable() && !mapping.shared() &&
+         mapping.path != "[vvar]" && mapping.path != "[vsyscall]";
+}
+
+void clearSoftDirtyOf(int pid) {
+  std::string path = fmt::format("/proc/{}/clear_refs", pid);
+  std::ofstream file(path);
+  file << "4";
+  file.flush();
+  if (!file) {
+    throw std::runtime_error(
+        fmt::format("Failed to clear soft-dirty bits with {}", path));
+  }
+}
+
+std::uint64_t readPagemapEntry(int fd, std::uint64_t addr) {
+  std::uint64_t entry = 0;
+  off_t offset = addr / Snapshot::pageSize * sizeof(entry);
+  if (::pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
+    return 0;
+  return entry;
+}
+
+// The kernel may be built without soft-dirty tracking, which then accepts
+// clear_refs but never sets the bit. Checked once, on a page of our own.
+bool softDirtySupported() {
+  static const bool supported = [] {
+    void *mem = ::mmap(nullptr, Snapshot::pageSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+      return false;
+    int fd = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    bool result = false;
+    if (fd >= 0) {
+      auto *page = static_cast<volatile std::uint8_t *>(mem);
+      page[0] = 1;
+      try {
+        clearSoftDirtyOf(::getpid());
+        page[0] = 2;
+        result = readPagemapEntry(fd, std::uint64_t(mem)) & pageSoftDirty;
+      } catch (const std::exception &) {
+      }
+      ::close(fd);
+    }
+    ::munmap(mem, Snapshot::pageSize);
+    Logging::debug("Snapshot: soft-dirty tracking supported: {}", result);
+    return result;
+  }();
+  return supported;
+}
+
+// Reads what pages of private file mappings held before they were first
+// written: the file's contents. The files are opened once per update.
+class OriginalPages {
+public:
+  OriginalPages() = default;
+  OriginalPages(const OriginalPages &) = delete;
+  OriginalPages &operator=(const OriginalPages &) = delete;
+  ~OriginalPages() {
+    for (auto [path, fd] : _files) {
+      if (fd >= 0)
+        ::close(fd);
+    }
+  }
+
+  // false if the file can't be read
+  bool read(const MemMaps::Mapping &mapping, std::uint64_t page,
+            std::uint8_t *out) {
+    auto [it, inserted] = _files.try_emplace(mapping.path, -1);
+    if (inserted)
+      it->second = ::open(mapping.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (it->second < 0)
+      return false;
+
+    // past the end of the file, the page is zero
+    std::fill_n(out, Snapshot::pageSize, 0);
+    off_t offset = mapping.offset + (page - mapping.low);
+    return ::pread(it->second, out, Snapshot::pageSize, offset) >= 0;
+  }
+
+private:
+  std::unordered_map<std::string, int> _files;
+};
+
+// changed byte ranges, skipping equal words at once
+std::vector<std::pair<std::uint32_t, std::uint32_t>>
+diffPage(const std::uint8_t *before, const std::uint8_t *after) {
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+  std::uint32_t i = 0;
+  while (i < Snapshot::pageSize) {
+    if (i % sizeof(std::uint64_t) == 0 &&
+        std::memcmp(before + i, after + i, sizeof(std::uint64_t)) == 0) {
+      i += sizeof(std::uint64_t);
+      continue;
+    }
+    if (before[i] == after[i]) {
+      ++i;
+      continue;
+    }
+    std::uint32_t begin = i;
+    while (i < Snapshot::pageSize && before[i] != after[i])
+      ++i;
+    ranges.emplace_back(begin, i);
+  }
+  return ranges;
+}
+
+} // namespace
+
+Snapshot::Snapshot(int pid, const MemMaps &maps)
+    : _pid(pid), _softDirty(softDirtySupported()) {
+  std::vector<std::uint64_t> pages = findPages(maps, false);
+  std::vector<std::uint8_t> contents = readPages(pages);
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    const std::uint8_t *data = contents.data() + i * pageSize;
+    _pages.emplace(pages[i], std::vector<std::uint8_t>(data, data + pageSize));
+  }
+  if (_softDirty)
+    clearSoftDirty();
+
+  _stats.pagesTracked = _pages.size();
+  _stats.pagesRead = pages.size();
+  Logging::debug("Snapshot: initial copy of {} pages", pages.size());
+}
+
+std::vector<Snapshot::PageChange> Snapshot::update(const MemMaps &maps) {
+  std::vector<std::uint64_t> pages = findPages(maps, _softDirty);
+  std::vector<std::uint8_t> contents = readPages(pages);
+  if (_softDirty)
+    clearSoftDirty();
+
+  // forget pages no longer mapped, or mapped differently
+  std::erase_if(_pages, [&](const auto &entry) {
+    const MemMaps::Mapping *mapping = maps.findMapping(entry.first);
+    return !mapping || !isTracked(*mapping);
+  });
+
+  OriginalPages originalPages;
+  std::vector<PageChange> changes;
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    const std::uint8_t *data = contents.data() + i * pageSize;
+    const MemMaps::Mapping *mapping = maps.findMapping(pages[i]);
+    bool isFile = mapping && mapping->path.starts_with('/');
+
+    // pages seen for the first time were zero before, or held the contents
+    // of their file
+    auto [it, inserted] =
+        _pages.try_emplace(pages[i], std::vector<std::uint8_t>(pageSize, 0));
+    std::vector<std::uint8_t> &copy = it->second;
+    bool newPage = inserted && isFile &&
+                   !originalPages.read(*mapping, pages[i], copy.data());
+    if (!newPage && std::memcmp(copy.data(), data, pageSize) == 0)
+      continue;
+
+    PageChange change;
+    change.page = pages[i];
+    change.region = mapping && !mapping->path.empty() ? mapping->path
+                                                      : "[anonymous]";
+    change.newPage = newPage;
+    if (newPage)
+      change.ranges.emplace_back(0, pageSize);
+    else
+      change.ranges = diffPage(copy.data(), data);
+    changes.push_back(std::move(change));
+    std::memcpy(copy.data(), data, pageSize);
+  }
+
+  _stats.pagesTracked = _pages.size();
+  _stats.pagesRead = pages.size();
+  _stats.pagesChanged = changes.size();
+  Logging::debug("Snapshot: read {} pages, {} changed", pages.size(),
+                 changes.size());
+  return changes;
+}
+
+const std::uint8_t *Snapshot::page(std::uint64_t addr) const {
+  auto it = _pages.find(addr & ~std::uint64_t(pageSize - 1));
+  return it == _pages.end() ? nullptr : it->second.data();
+}
+
+std::vector<std::uint64_t> Snapshot::findPages(const MemMaps &maps,
+                                               bool dirtyOnly) const {
+  std::string path = fmt::format("/proc/{}/pagemap", _pid);
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(
+        fmt::format("Failed to open {}: {}", path, std::strerror(errno)));
+  }
+
+  std::vector<std::uint64_t> pages;
+  std::vector<std::uint64_t> entries(pagemapChunk);
+  for (const MemMaps::Mapping &mapping : maps.mappings()) {
+    if (!isTracked(mapping))
+      continue;
+    for (std::uint64_t addr = mapping.low; addr < mapping.high;) {
+      std::size_t count = std::min<std::uint64_t>(
+          pagemapChunk, (mapping.high - addr) / pageSize);
+      off_t offset = addr / pageSize * sizeof(std::uint64_t);
+      ::ssize_t res = ::pread(fd, entries.data(),
+                              count * sizeof(std::uint64_t), offset);
+      if (res <= 0) {
+        Logging::error("Snapshot: failed to read {} at 0x{:x}: {}", path,
+                       addr, res < 0 ? std::strerror(errno) : "end of file");
+        break;
+      }
+      count = res / sizeof(std::uint64_t);
+      for (std::size_t i = 0; i < count; ++i) {
+        std::uint64_t entry = entries[i];
+        if (!(entry & (pagePresent | pageSwapped)))
+          continue;
+        if (dirtyOnly && !(entry & pageSoftDirty))
+          continue;
+        pages.push_back(addr + i * pageSize);
+      }
+      addr += count * pageSize;
+    }
+  }
+
+  ::close(fd);
+  return pages;
+}
+
+std::vector<std::uint8_t>
+Snapshot::readPages(std::vector<std::uint64_t> &pages) const {
+  std::vector<std::uint8_t> contents(pages.size() * pageSize);
+  std::vector<bool> readable(pages.size(), false);
+  std::vector<::iovec> remote;
+  remote.reserve(maxIovecs);
+
+  // adjacent pages are merged into one iovec, many iovecs per syscall
+  std::size_t next = 0;
+  while (next < pages.size()) {
+    remote.clear();
+    std::size_t end = next;
+    for (; end < pages.size(); ++end) {
+      if (!remote.empty() && std::uint64_t(remote.back().iov_base) +
+                                     remote.back().iov_len ==
+                                 pages[end]) {
+        remote.back().iov_len += pageSize;
+      } else if (remote.size() < maxIovecs) {
+        remote.push_back({(void *)pages[end], pageSize});
+      } else {
+        break;
+      }
+    }
+
+    ::iovec local{contents.data() + next * pageSize, (end - next) * pageSize};
+    ::ssize_t res =
+        ::process_vm_readv(_pid, &local, 1, remote.data(), remote.size(), 0);
+    std::size_t done = res < 0 ? 0 : res / pageSize;
+    std::fill_n(readable.begin() + next, done, true);
+    // a short read stops at a page which can't be read, skip it
+    next += done < end - next ? done + 1 : done;
+  }
+
+  // drop the unreadable pages
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    if (!readable[i])
+      continue;
+    if (out != i) {
+      pages[out] = pages[i];
+      std::memcpy(contents.data() + out * pageSize,
+                  contents.data() + i * pageSize, pageSize);
+    }
+    ++out;
+  }
+  if (out != pages.size()) {
+    Logging::debug("Snapshot: {} pages could not be read",
+                   pages.size() - out);
+  }
+  pages.resize(out);
+  contents.resize(out * pageSize);
+  return contents;
+}
+
+void Snapshot::clearSoftDirty() const { clearSoftDirtyOf(_pid); }
+
+} // namespace Whiteboard
\ No newline at end of file
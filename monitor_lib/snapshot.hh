@@ -0,0 +1,70 @@
+#pragma once
+
+#include "mem_maps.hh"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Whiteboard {
+
+// Copy of the private writable memory of a stopped process, kept up to date
+// incrementally. The kernel's soft-dirty bits tell which pages were written
+// since the last update, so only those are read and compared: the cost is
+// proportional to the working set, not to the size of the process.
+//
+// Without soft-dirty support in the kernel (CONFIG_MEM_SOFT_DIRTY), every
+// resident page is read on each update.
+class Snapshot {
+public:
+  static constexpr std::size_t pageSize = 4096;
+
+  struct PageChange {
+    std::uint64_t page; // address of the page
+    std::string region; // path of the mapping, like "[heap]"
+    // byte ranges changed within the page, as [begin, end) offsets
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges;
+    // first seen, from a file that can't be read: what it held before is
+    // unknown, all of it is reported as changed
+    bool newPage = false;
+  };
+
+  struct Stats {
+    std::size_t pagesTracked = 0; // copies held
+    std::size_t pagesRead = 0;    // in the last update
+    std::size_t pagesChanged = 0; // in the last update
+  };
+
+  // Copies the resident memory of the process, which must be stopped, and
+  // starts tracking writes to it.
+  Snapshot(int pid, const MemMaps &maps);
+
+  // Reads pages written since the snapshot was taken or last updated,
+  // returns the differences and keeps the new contents. The process must be
+  // stopped. Pages of mappings gone since are forgotten.
+  std::vector<PageChange> update(const MemMaps &maps);
+
+  // the copy of the page at address, nullptr if not held
+  const std::uint8_t *page(std::uint64_t addr) const;
+
+  bool usesSoftDirty() const { return _softDirty; }
+  const Stats &stats() const { return _stats; }
+
+private:
+  // pages of the tracked mappings that may have changed: all resident ones,
+  // or just the soft-dirty ones
+  std::vector<std::uint64_t> findPages(const MemMaps &maps,
+                                       bool dirtyOnly) const;
+  // reads the pages, dropping those which can't be read
+  std::vector<std::uint8_t> readPages(std::vector<std::uint64_t> &pages) const;
+  void clearSoftDirty() const;
+
+  int _pid;
+  bool _softDirty;
+  std::map<std::uint64_t, std::vector<std::uint8_t>> _pages;
+  Stats _stats;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
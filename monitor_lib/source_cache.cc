@@ -0,0 +1,135 @@
+#include "source_cache.hh"
+
+#include "logging.hh"
+
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <emmintrin.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Whiteboard {
+
+namespace {
+
+// Appends the offsets following the line breaks, 16 bytes compared at once
+void indexLines(const char *data, std::size_t size,
+                std::vector<std::uint32_t> &lineStarts) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+    for (; mask != 0; mask &= mask - 1)
+      lineStarts.push_back(i + std::countr_zero(mask) + 1);
+  }
+  for (; i < size; ++i) {
+    if (data[i] == '\n')
+      lineStarts.push_back(i + 1);
+  }
+}
+
+} // namespace
+
+SourceCache::~SourceCache() {
+  for (auto &[path, file] : _files)
+    unmap(file);
+}
+
+std::optional<std::string_view> SourceCache::line(const std::string &path,
+                                                  std::uint32_t line) {
+  const File &f = file(path);
+  if (line == 0 || line >= f.lineStarts.size())
+    return std::nullopt;
+
+  std::string_view text(f.data + f.lineStarts[line - 1],
+                        f.lineStarts[line] - f.lineStarts[line - 1]);
+  while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+    text.remove_suffix(1);
+  return text;
+}
+
+std::optional<std::uint32_t> SourceCache::lineCount(const std::string &path) {
+  const File &f = file(path);
+  if (f.lineStarts.empty())
+    return std::nullopt;
+  return f.lineStarts.size() - 1;
+}
+
+const SourceCache::File &SourceCache::file(const std::string &path) {
+  auto [it, inserted] = _files.try_emplace(path);
+  File &f = it->second;
+  if (inserted) {
+    load(path, f);
+    _lru.push_front(path);
+    f.lru = _lru.begin();
+    _bytes += f.bytes();
+    evict(f);
+  } else if (f.lru != _lru.begin()) {
+    _lru.splice(_lru.begin(), _lru, f.lru);
+  }
+  return f;
+}
+
+void SourceCache::load(const std::string &path, File &file) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logging::debug("SourceCache: unable to open '{}': {}", path,
+                   std::strerror(errno));
+    return;
+  }
+  struct ::stat st {};
+  bool readable = ::fstat(fd, &st) == 0 &&
+                  std::uint64_t(st.st_size) <
+                      std::numeric_limits<std::uint32_t>::max();
+  void *data = MAP_FAILED;
+  if (readable && st.st_size > 0)
+    data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (!readable || (st.st_size > 0 && data == MAP_FAILED)) {
+    Logging::debug("SourceCache: unable to map '{}'", path);
+    return;
+  }
+
+  // an empty file has no lines, but can be read
+  file.lineStarts.push_back(0);
+  if (st.st_size == 0)
+    return;
+  file.data = static_cast<const char *>(data);
+  file.size = st.st_size;
+
+  indexLines(file.data, file.size, file.lineStarts);
+  // the last line may not end with a line break
+  if (file.lineStarts.back() != file.size)
+    file.lineStarts.push_back(file.size);
+  file.lineStarts.shrink_to_fit();
+  Logging::trace("SourceCache: mapped '{}', {} lines", path,
+                 file.lineStarts.size() - 1);
+}
+
+void SourceCache::evict(const File &keep) {
+  while (_bytes > _maxBytes && _lru.size() > 1) {
+    auto it = _files.find(_lru.back());
+    if (&it->second == &keep)
+      break;
+    Logging::trace("SourceCache: unmapping '{}'", it->first);
+    _bytes -= it->second.bytes();
+    unmap(it->second);
+    _lru.pop_back();
+    _files.erase(it);
+  }
+}
+
+void SourceCache::unmap(File &file) {
+  if (file.data)
+    ::munmap(const_cast<char *>(file.data), file.size);
+  file.data = nullptr;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
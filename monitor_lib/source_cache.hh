@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+// Text of source files, for printing the lines of source locations. A file
+// is mapped into memory on first use, and indexed by the offsets of its
+// lines, so each line after that is found in constant time.
+//
+// The files least recently used are unmapped when the mapped files and
+// their indexes would take more than the limit, so the lines returned are
+// valid only until the next call.
+class SourceCache {
+public:
+  static constexpr std::size_t defaultMaxBytes = 256 << 20;
+
+  explicit SourceCache(std::size_t maxBytes = defaultMaxBytes)
+      : _maxBytes(maxBytes) {}
+  ~SourceCache();
+
+  SourceCache(const SourceCache &) = delete;
+  SourceCache &operator=(const SourceCache &) = delete;
+
+  // The line, numbered from 1, without the line break. nullopt if the file
+  // can't be read, or has fewer lines.
+  std::optional<std::string_view> line(const std::string &path,
+                                       std::uint32_t line);
+  // number of lines of the file, nullopt if it can't be read
+  std::optional<std::uint32_t> lineCount(const std::string &path);
+
+  // mapped files and their indexes
+  std::size_t bytes() const { return _bytes; }
+
+private:
+  struct File {
+    const char *data = nullptr; // nullptr if the file can't be read
+    std::size_t size = 0;
+    // offsets of the beginnings of the lines, and the end of the file
+    std::vector<std::uint32_t> lineStarts;
+    std::list<std::string>::iterator lru;
+
+    std::size_t bytes() const {
+      return size + lineStarts.size() * sizeof(std::uint32_t);
+    }
+  };
+
+  // the file, mapped if it wasn't, as the most recently used
+  const File &file(const std::string &path);
+  void load(const std::string &path, File &file);
+  // unmaps the least recently used files other than `keep`
+  void evict(const File &keep);
+  static void unmap(File &file);
+
+  std::size_t _maxBytes;
+  std::size_t _bytes = 0;
+  std::unordered_map<std::string, File> _files;
+  std::list<std::string> _lru; // paths, the most recently used first
+};
+
+} // namespace Whiteboard
\ No newline at end of file
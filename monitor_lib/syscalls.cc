@@ -0,0 +1,400 @@
+#include "syscalls.hh"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <sys/time.h>
+#include <sys/times.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+
+namespace Whiteboard {
+
+namespace {
+
+// how an argument or result is decoded
+enum class Arg {
+  None,
+  Int,
+  Size,
+  Ptr,
+  Fd,
+  Mode,
+  Prot,
+  MapFlags,
+  MremapFlags,
+  OpenFlags
+};
+
+struct SyscallDesc {
+  long number;
+  const char *name;
+  std::array<Arg, 6> args;
+  Arg result = Arg::Int;
+};
+
+using A = Arg;
+
+// the commonly seen syscalls; the rest is reported by number
+const SyscallDesc syscalls[] = {
+    {SYS_read, "read", {A::Fd, A::Ptr, A::Size}},
+    {SYS_write, "write", {A::Fd, A::Ptr, A::Size}},
+    {SYS_open, "open", {A::Ptr, A::OpenFlags, A::Mode}},
+    {SYS_close, "close", {A::Fd}},
+    {SYS_stat, "stat", {A::Ptr, A::Ptr}},
+    {SYS_fstat, "fstat", {A::Fd, A::Ptr}},
+    {SYS_lstat, "lstat", {A::Ptr, A::Ptr}},
+    {SYS_poll, "poll", {A::Ptr, A::Size, A::Int}},
+    {SYS_lseek, "lseek", {A::Fd, A::Int, A::Int}},
+    {SYS_mmap,
+     "mmap",
+     {A::Ptr, A::Size, A::Prot, A::MapFlags, A::Fd, A::Size},
+     A::Ptr},
+    {SYS_mprotect, "mprotect", {A::Ptr, A::Size, A::Prot}},
+    {SYS_munmap, "munmap", {A::Ptr, A::Size}},
+    {SYS_brk, "brk", {A::Ptr}, A::Ptr},
+    {SYS_rt_sigaction, "rt_sigaction", {A::Int, A::Ptr, A::Ptr, A::Size}},
+    {SYS_rt_sigprocmask, "rt_sigprocmask", {A::Int, A::Ptr, A::Ptr, A::Size}},
+    {SYS_ioctl, "ioctl", {A::Fd, A::Ptr, A::Ptr}},
+    {SYS_pread64, "pread64", {A::Fd, A::Ptr, A::Size, A::Int}},
+    {SYS_pwrite64, "pwrite64", {A::Fd, A::Ptr, A::Size, A::Int}},
+    {SYS_readv, "readv", {A::Fd, A::Ptr, A::Int}},
+    {SYS_writev, "writev", {A::Fd, A::Ptr, A::Int}},
+    {SYS_access, "access", {A::Ptr, A::Mode}},
+    {SYS_pipe, "pipe", {A::Ptr}},
+    {SYS_mremap,
+     "mremap",
+     {A::Ptr, A::Size, A::Size, A::MremapFlags, A::Ptr},
+     A::Ptr},
+    {SYS_msync, "msync", {A::Ptr, A::Size, A::Int}},
+    {SYS_madvise, "madvise", {A::Ptr, A::Size, A::Int}},
+    {SYS_dup, "dup", {A::Fd}},
+    {SYS_dup2, "dup2", {A::Fd, A::Fd}},
+    {SYS_nanosleep, "nanosleep", {A::Ptr, A::Ptr}},
+    {SYS_getpid, "getpid", {}},
+    {SYS_socket, "socket", {A::Int, A::Int, A::Int}},
+    {SYS_connect, "connect", {A::Fd, A::Ptr, A::Size}},
+    {SYS_clone, "clone", {A::Ptr, A::Ptr, A::Ptr, A::Ptr, A::Ptr}},
+    {SYS_fork, "fork", {}},
+    {SYS_vfork, "vfork", {}},
+    {SYS_execve, "execve", {A::Ptr, A::Ptr, A::Ptr}},
+    {SYS_exit, "exit", {A::Int}},
+    {SYS_wait4, "wait4", {A::Int, A::Ptr, A::Int, A::Ptr}},
+    {SYS_kill, "kill", {A::Int, A::Int}},
+    {SYS_fcntl, "fcntl", {A::Fd, A::Int, A::Ptr}},
+    {SYS_getcwd, "getcwd", {A::Ptr, A::Size}},
+    {SYS_mkdir, "mkdir", {A::Ptr, A::Mode}},
+    {SYS_unlink, "unlink", {A::Ptr}},
+    {SYS_readlink, "readlink", {A::Ptr, A::Ptr, A::Size}},
+    {SYS_gettid, "gettid", {}},
+    {SYS_futex, "futex", {A::Ptr, A::Int, A::Int, A::Ptr, A::Ptr, A::Int}},
+    {SYS_set_tid_address, "set_tid_address", {A::Ptr}},
+    {SYS_clock_gettime, "clock_gettime", {A::Int, A::Ptr}},
+    {SYS_exit_group, "exit_group", {A::Int}},
+    {SYS_openat, "openat", {A::Fd, A::Ptr, A::OpenFlags, A::Mode}},
+    {SYS_newfstatat, "newfstatat", {A::Fd, A::Ptr, A::Ptr, A::Int}},
+    {SYS_set_robust_list, "set_robust_list", {A::Ptr, A::Size}},
+    {SYS_pipe2, "pipe2", {A::Ptr, A::OpenFlags}},
+    {SYS_prlimit64, "prlimit64", {A::Int, A::Int, A::Ptr, A::Ptr}},
+    {SYS_getrandom, "getrandom", {A::Ptr, A::Size, A::Int}},
+    {SYS_rseq, "rseq", {A::Ptr, A::Size, A::Int, A::Int}},
+};
+
+// how the memory written by a syscall is given by its arguments
+enum class Out {
+  Buffer,   // at `ptr`, `size` bytes times the argument `count` if any
+  LengthAt, // at `ptr`, of the socklen_t length pointed at by `count`
+  Iovecs,   // the iovec array at `ptr`, of `count` elements
+  Message,  // the msghdr at `ptr`, and what it points at
+};
+
+struct OutputDesc {
+  long number;
+  Out kind;
+  int ptr;
+  int count = -1;
+  std::uint64_t size = 1;
+};
+
+using O = Out;
+
+// the kernel's struct sigaction: handler, flags, restorer and mask
+constexpr std::uint64_t kernelSigactionSize = 32;
+
+const OutputDesc outputs[] = {
+    {SYS_read, O::Buffer, 1, 2},
+    {SYS_pread64, O::Buffer, 1, 2},
+    {SYS_readv, O::Iovecs, 1, 2},
+    {SYS_preadv, O::Iovecs, 1, 2},
+    {SYS_preadv2, O::Iovecs, 1, 2},
+    {SYS_stat, O::Buffer, 1, -1, sizeof(struct ::stat)},
+    {SYS_fstat, O::Buffer, 1, -1, sizeof(struct ::stat)},
+    {SYS_lstat, O::Buffer, 1, -1, sizeof(struct ::stat)},
+    {SYS_newfstatat, O::Buffer, 2, -1, sizeof(struct ::stat)},
+    {SYS_statx, O::Buffer, 4, -1, sizeof(struct ::statx)},
+    {SYS_poll, O::Buffer, 0, 1, sizeof(::pollfd)},
+    {SYS_ppoll, O::Buffer, 0, 1, sizeof(::pollfd)},
+    {SYS_select, O::Buffer, 1, -1, sizeof(::fd_set)},
+    {SYS_select, O::Buffer, 2, -1, sizeof(::fd_set)},
+    {SYS_select, O::Buffer, 3, -1, sizeof(::fd_set)},
+    {SYS_pselect6, O::Buffer, 1, -1, sizeof(::fd_set)},
+    {SYS_pselect6, O::Buffer, 2, -1, sizeof(::fd_set)},
+    {SYS_pselect6, O::Buffer, 3, -1, sizeof(::fd_set)},
+    {SYS_epoll_wait, O::Buffer, 1, 2, sizeof(::epoll_event)},
+    {SYS_epoll_pwait, O::Buffer, 1, 2, sizeof(::epoll_event)},
+    {SYS_rt_sigaction, O::Buffer, 2, -1, kernelSigactionSize},
+    {SYS_rt_sigprocmask, O::Buffer, 2, 3},
+    {SYS_pipe, O::Buffer, 0, -1, 2 * sizeof(int)},
+    {SYS_pipe2, O::Buffer, 0, -1, 2 * sizeof(int)},
+    {SYS_socketpair, O::Buffer, 3, -1, 2 * sizeof(int)},
+    {SYS_nanosleep, O::Buffer, 1, -1, sizeof(::timespec)},
+    {SYS_clock_nanosleep, O::Buffer, 3, -1, sizeof(::timespec)},
+    {SYS_clock_gettime, O::Buffer, 1, -1, sizeof(::timespec)},
+    {SYS_gettimeofday, O::Buffer, 0, -1, sizeof(::timeval)},
+    {SYS_getcwd, O::Buffer, 0, 1},
+    {SYS_readlink, O::Buffer, 1, 2},
+    {SYS_readlinkat, O::Buffer, 2, 3},
+    {SYS_wait4, O::Buffer, 1, -1, sizeof(int)},
+    {SYS_wait4, O::Buffer, 3, -1, sizeof(::rusage)},
+    {SYS_uname, O::Buffer, 0, -1, sizeof(::utsname)},
+    {SYS_sysinfo, O::Buffer, 0, -1, sizeof(struct ::sysinfo)},
+    {SYS_times, O::Buffer, 0, -1, sizeof(::tms)},
+    {SYS_getrlimit, O::Buffer, 1, -1, sizeof(::rlimit)},
+    {SYS_prlimit64, O::Buffer, 3, -1, sizeof(::rlimit)},
+    {SYS_getdents64, O::Buffer, 1, 2},
+    {SYS_getrandom, O::Buffer, 0, 1},
+    {SYS_recvfrom, O::Buffer, 1, 2},
+    {SYS_recvfrom, O::LengthAt, 4, 5},
+    {SYS_recvfrom, O::Buffer, 5, -1, sizeof(::socklen_t)},
+    {SYS_recvmsg, O::Message, 1},
+    {SYS_accept, O::LengthAt, 1, 2},
+    {SYS_accept, O::Buffer, 2, -1, sizeof(::socklen_t)},
+    {SYS_accept4, O::LengthAt, 1, 2},
+    {SYS_accept4, O::Buffer, 2, -1, sizeof(::socklen_t)},
+    {SYS_getsockname, O::LengthAt, 1, 2},
+    {SYS_getsockname, O::Buffer, 2, -1, sizeof(::socklen_t)},
+    {SYS_getpeername, O::LengthAt, 1, 2},
+    {SYS_getpeername, O::Buffer, 2, -1, sizeof(::socklen_t)},
+    {SYS_getsockopt, O::LengthAt, 3, 4},
+    {SYS_getsockopt, O::Buffer, 4, -1, sizeof(::socklen_t)},
+};
+
+// bound on the iovecs read, as the kernel's IOV_MAX
+constexpr std::uint64_t maxIovecs = 1024;
+
+void addIovecs(std::uint64_t iov, std::uint64_t count,
+               const ReadWord &readWord, std::vector<SyscallOutput> &out) {
+  for (std::uint64_t i = 0; i < std::min(count, maxIovecs); ++i) {
+    auto base = readWord(iov + i * sizeof(::iovec));
+    auto len = readWord(iov + i * sizeof(::iovec) + 8);
+    if (!base || !len)
+      return;
+    out.push_back(SyscallOutput{*base, *len});
+  }
+}
+
+const SyscallDesc *findDesc(long number) {
+  auto it = std::ranges::find(syscalls, number, &SyscallDesc::number);
+  return it == std::end(syscalls) ? nullptr : &*it;
+}
+
+using FlagNames = std::initializer_list<std::pair<std::uint64_t, const char *>>;
+
+std::string formatFlags(std::uint64_t value, FlagNames names) {
+  std::string out;
+  for (auto [flag, name] : names) {
+    if (flag != 0 && (value & flag) == flag) {
+      if (!out.empty())
+        out += '|';
+      out += name;
+      value &= ~flag;
+    }
+  }
+  if (value != 0 || out.empty()) {
+    if (!out.empty())
+      out += '|';
+    out += fmt::format("0x{:x}", value);
+  }
+  return out;
+}
+
+std::string formatArg(Arg type, std::uint64_t value) {
+  switch (type) {
+  case Arg::None:
+    return {};
+  case Arg::Int:
+    return fmt::format("{}", std::int64_t(value));
+  case Arg::Size:
+    return fmt::format("{}", value);
+  case Arg::Ptr:
+    return value == 0 ? "NULL" : fmt::format("0x{:x}", value);
+  case Arg::Fd:
+    if (int(value) == AT_FDCWD)
+      return "AT_FDCWD";
+    return fmt::format("{}", int(value));
+  case Arg::Mode:
+    return fmt::format("0{:o}", value);
+  case Arg::Prot:
+    if (value == PROT_NONE)
+      return "PROT_NONE";
+    return formatFlags(value, {{PROT_READ, "PROT_READ"},
+                               {PROT_WRITE, "PROT_WRITE"},
+                               {PROT_EXEC, "PROT_EXEC"}});
+  case Arg::MapFlags:
+    // the validating variant has both bits of the sharing type
+    return formatFlags(value, {{MAP_SHARED_VALIDATE, "MAP_SHARED_VALIDATE"},
+                               {MAP_SHARED, "MAP_SHARED"},
+                               {MAP_PRIVATE, "MAP_PRIVATE"},
+                               {MAP_FIXED, "MAP_FIXED"},
+                               {MAP_ANONYMOUS, "MAP_ANONYMOUS"},
+                               {MAP_NORESERVE, "MAP_NORESERVE"},
+                               {MAP_POPULATE, "MAP_POPULATE"},
+                               {MAP_STACK, "MAP_STACK"},
+                               {MAP_GROWSDOWN, "MAP_GROWSDOWN"},
+                               {MAP_DENYWRITE, "MAP_DENYWRITE"},
+                               {MAP_FIXED_NOREPLACE, "MAP_FIXED_NOREPLACE"}});
+  case Arg::MremapFlags:
+    return formatFlags(value, {{MREMAP_MAYMOVE, "MREMAP_MAYMOVE"},
+                               {MREMAP_FIXED, "MREMAP_FIXED"},
+                               {MREMAP_DONTUNMAP, "MREMAP_DONTUNMAP"}});
+  case Arg::OpenFlags: {
+    const char *access = (value & O_ACCMODE) == O_WRONLY ? "O_WRONLY"
+                         : (value & O_ACCMODE) == O_RDWR ? "O_RDWR"
+                                                         : "O_RDONLY";
+    value &= ~std::uint64_t(O_ACCMODE);
+    if (value == 0)
+      return access;
+    return fmt::format("{}|{}", access,
+                       formatFlags(value, {{O_CREAT, "O_CREAT"},
+                                           {O_EXCL, "O_EXCL"},
+                                           {O_TRUNC, "O_TRUNC"},
+                                           {O_APPEND, "O_APPEND"},
+                                           {O_NONBLOCK, "O_NONBLOCK"},
+                                           {O_DIRECTORY, "O_DIRECTORY"},
+                                           {O_NOFOLLOW, "O_NOFOLLOW"},
+                                           {O_CLOEXEC, "O_CLOEXEC"}}));
+  }
+  }
+  return {};
+}
+
+} // namespace
+
+std::optional<long> syscallNumber(std::string_view name) {
+  auto it = std::ranges::find_if(
+      syscalls, [&](const SyscallDesc &desc) { return desc.name == name; });
+  if (it == std::end(syscalls))
+    return std::nullopt;
+  return it->number;
+}
+
+std::string syscallName(long number) {
+  if (const SyscallDesc *desc = findDesc(number))
+    return desc->name;
+  return fmt::format("syscall_{}", number);
+}
+
+std::string formatSyscall(const SyscallInfo &info) {
+  const SyscallDesc *desc = findDesc(info.number);
+
+  std::string args;
+  if (desc) {
+    for (std::size_t i = 0; i < desc->args.size(); ++i) {
+      if (desc->args[i] == Arg::None)
+        break;
+      if (i > 0)
+        args += ", ";
+      args += formatArg(desc->args[i], info.args[i]);
+    }
+  } else {
+    args = fmt::format("0x{:x}, 0x{:x}, 0x{:x}, 0x{:x}, 0x{:x}, 0x{:x}",
+                       info.args[0], info.args[1], info.args[2], info.args[3],
+                       info.args[4], info.args[5]);
+  }
+
+  std::string result;
+  if (info.result < 0 && info.result >= -4095) {
+    int error = -info.result;
+    const char *errorName = ::strerrorname_np(error);
+    result = fmt::format("-1 {} ({})", errorName ? errorName : "?",
+                         std::strerror(error));
+  } else {
+    result = formatArg(desc ? desc->result : Arg::Int, info.result);
+  }
+
+  return fmt::format("{}({}) = {}", syscallName(info.number), args, result);
+}
+
+std::vector<long> memoryWritingSyscalls() {
+  std::vector<long> numbers;
+  for (const OutputDesc &desc : outputs) {
+    if (numbers.empty() || numbers.back() != desc.number)
+      numbers.push_back(desc.number);
+  }
+  return numbers;
+}
+
+std::vector<SyscallOutput> syscallOutputs(const SyscallInfo &info,
+                                          const ReadWord &readWord) {
+  std::vector<SyscallOutput> out;
+  for (const OutputDesc &desc : outputs) {
+    if (desc.number != info.number)
+      continue;
+    std::uint64_t ptr = info.args[desc.ptr];
+    if (ptr == 0)
+      continue;
+
+    switch (desc.kind) {
+    case Out::Buffer: {
+      std::uint64_t count = desc.count < 0 ? 1 : info.args[desc.count];
+      out.push_back(SyscallOutput{ptr, count * desc.size});
+      break;
+    }
+    case Out::LengthAt:
+      if (info.args[desc.count] == 0)
+        break;
+      if (auto len = readWord(info.args[desc.count]))
+        out.push_back(SyscallOutput{ptr, std::uint32_t(*len)});
+      break;
+    case Out::Iovecs:
+      addIovecs(ptr, info.args[desc.count], readWord, out);
+      break;
+    case Out::Message: {
+      // the lengths and flags are written back too
+      out.push_back(SyscallOutput{ptr, sizeof(::msghdr)});
+      auto name = readWord(ptr + offsetof(::msghdr, msg_name));
+      auto nameLen = readWord(ptr + offsetof(::msghdr, msg_namelen));
+      if (name && nameLen && *name != 0)
+        out.push_back(SyscallOutput{*name, std::uint32_t(*nameLen)});
+      auto iov = readWord(ptr + offsetof(::msghdr, msg_iov));
+      auto iovLen = readWord(ptr + offsetof(::msghdr, msg_iovlen));
+      if (iov && iovLen)
+        addIovecs(*iov, *iovLen, readWord, out);
+      auto control = readWord(ptr + offsetof(::msghdr, msg_control));
+      auto controlLen = readWord(ptr + offsetof(::msghdr, msg_controllen));
+      if (control && controlLen && *control != 0)
+        out.push_back(SyscallOutput{*control, *controlLen});
+      break;
+    }
+    }
+  }
+  return out;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <fmt/format.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Whiteboard {
+
+// A system call made by the traced process, with its result
+struct SyscallInfo {
+  long number = -1;
+  std::array<std::uint64_t, 6> args = {};
+  std::int64_t result = 0;
+};
+
+// x86_64 syscall number by name, nullopt if unknown
+std::optional<long> syscallNumber(std::string_view name);
+// syscall name, or "syscall_<number>" if unknown
+std::string syscallName(long number);
+
+// human-readable form, like strace: name(decoded args) = result
+std::string formatSyscall(const SyscallInfo &info);
+
+// memory a syscall may write into
+struct SyscallOutput {
+  std::uint64_t addr;
+  std::uint64_t len;
+};
+
+// numbers of the syscalls writing into memory given by their arguments,
+// those known to syscallOutputs()
+std::vector<long> memoryWritingSyscalls();
+
+using ReadWord = std::function<std::optional<std::uint64_t>(std::uint64_t)>;
+
+// Memory the syscall may write into, from its arguments at entry. Lengths
+// and iovecs in the process memory are read with `readWord`, those not
+// readable are skipped: the syscall fails on them too.
+std::vector<SyscallOutput> syscallOutputs(const SyscallInfo &info,
+                                          const ReadWord &readWord);
+
+} // namespace Whiteboard
+
+template <> struct fmt::formatter<Whiteboard::SyscallInfo> {
+  constexpr auto parse(format_parse_context &ctx) { return ctx.begin(); }
+
+  auto format(const Whiteboard::SyscallInfo &info, format_context &ctx) const {
+    return fmt::format_to(ctx.out(), "{}", Whiteboard::formatSyscall(info));
+  }
+};
\ No newline at end of file
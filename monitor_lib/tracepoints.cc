@@ -0,0 +1,253 @@
+#include "tracepoints.hh"
+
+#include "x86_decoder.hh"
+
+#include <fmt/core.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+
+namespace Whiteboard {
+
+namespace {
+
+// x86_64 register numbers, as used in instruction encoding
+enum Gpr : std::uint8_t {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15
+};
+
+class CodeWriter {
+public:
+  void emit(std::initializer_list<std::uint8_t> bytes) {
+    _code.insert(_code.end(), bytes);
+  }
+  void emit(std::span<const std::uint8_t> bytes) {
+    _code.insert(_code.end(), bytes.begin(), bytes.end());
+  }
+  void emit32(std::uint32_t value) { emitValue(value); }
+  void emit64(std::uint64_t value) { emitValue(value); }
+
+  // mov [rcx + disp32], reg
+  void storeToRcx(Gpr reg, std::uint32_t disp) {
+    emit({std::uint8_t(0x48 | (reg >= R8 ? 0x04 : 0)), 0x89,
+          std::uint8_t(0x81 | (reg & 7) << 3)});
+    emit32(disp);
+  }
+
+  std::size_t size() const { return _code.size(); }
+  std::vector<std::uint8_t> take() { return std::move(_code); }
+
+private:
+  template <typename T> void emitValue(T value) {
+    std::uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    emit(bytes);
+  }
+
+  std::vector<std::uint8_t> _code;
+};
+
+std::int64_t checkedRel32(std::int64_t value) {
+  if (value < std::numeric_limits<std::int32_t>::min() ||
+      value > std::numeric_limits<std::int32_t>::max())
+    throw std::runtime_error("Jump distance out of 32-bit range");
+  return value;
+}
+
+} // namespace
+
+TracepointRing::TracepointRing(std::uint32_t capacity)
+    : _capacity(std::bit_ceil(capacity)),
+      _memory("whiteboard-tracepoints",
+              slotsOffset + _capacity * sizeof(Slot)) {
+  static_assert(sizeof(Header) <= slotsOffset);
+  new (_memory.data()) Header{0};
+  for (std::uint64_t i = 0; i < _capacity; ++i)
+    new (&slot(i)) Slot{0, 0, {}};
+}
+
+TracepointRing::Slot &TracepointRing::slot(std::uint64_t position) const {
+  auto *slots = reinterpret_cast<Slot *>(static_cast<char *>(_memory.data()) +
+                                         slotsOffset);
+  return slots[position & (_capacity - 1)];
+}
+
+std::uint64_t TracepointRing::drain(std::vector<TracepointHit> &hits) {
+  std::uint64_t lost = 0;
+  std::uint64_t head = header().head.load(std::memory_order_acquire);
+
+  // overwritten before read
+  if (head - _tail > _capacity) {
+    lost += head - _tail - _capacity;
+    _tail = head - _capacity;
+  }
+
+  for (; _tail < head; ++_tail) {
+    Slot &s = slot(_tail);
+    std::uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+    if (sequence < _tail + 1)
+      break; // still being written
+    if (sequence > _tail + 1) {
+      ++lost; // overwritten
+      continue;
+    }
+
+    TracepointHit hit;
+    hit.tracepoint = s.tracepoint;
+    for (int i = 0; i < Registers::NUM_REGISTERS; ++i)
+      hit.registers[i].set64(s.registers[i]);
+
+    // the writer that laps the reader invalidates the sequence first
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.sequence.load(std::memory_order_relaxed) != sequence) {
+      ++lost;
+      continue;
+    }
+    hits.push_back(hit);
+  }
+  return lost;
+}
+
+std::vector<std::uint8_t> TracepointRing::makeTrampoline(
+    tracepoint_id id, addr_t address, addr_t ringAddress, addr_t probeAddress,
+    std::span<const std::uint8_t> originalCode) const {
+
+  constexpr std::uint8_t redZone = 128;
+  auto registerOffset = [](int index) {
+    return std::uint32_t(offsetof(Slot, registers) + index * 8);
+  };
+
+  CodeWriter c;
+  // lea rsp, [rsp - 128]: the interrupted code may use the red zone
+  c.emit({0x48, 0x8d, 0x64, 0x24, std::uint8_t(-redZone)});
+  // pushfq; push rax; push rbx; push rcx
+  c.emit({0x9c, 0x50, 0x53, 0x51});
+
+  // reserve a slot: rbx = lock xadd [ring.head], 1
+  c.emit({0x48, 0xb8}); // movabs rax, ringAddress
+  c.emit64(ringAddress);
+  c.emit({0xbb, 0x01, 0x00, 0x00, 0x00}); // mov ebx, 1
+  c.emit({0xf0, 0x48, 0x0f, 0xc1, 0x18}); // lock xadd [rax], rbx
+
+  // rcx = slot address
+  c.emit({0x48, 0x89, 0xd9}); // mov rcx, rbx
+  c.emit({0x81, 0xe1});       // and ecx, capacity - 1
+  c.emit32(_capacity - 1);
+  c.emit({0x48, 0x69, 0xc9}); // imul rcx, rcx, sizeof(Slot)
+  c.emit32(sizeof(Slot));
+  c.emit({0x48, 0x8d, 0x8c, 0x08}); // lea rcx, [rax + rcx + slotsOffset]
+  c.emit32(slotsOffset);
+
+  // mov qword [rcx], 0: invalidate the slot, in case the reader is on it
+  c.emit({0x48, 0xc7, 0x01, 0x00, 0x00, 0x00, 0x00});
+  // mov qword [rcx + tracepoint], id
+  c.emit({0x48, 0xc7, 0x81});
+  c.emit32(offsetof(Slot, tracepoint));
+  c.emit32(id);
+
+  // registers not touched so far are stored directly
+  struct {
+    Gpr gpr;
+    Registers::Names name;
+  } direct[] = {{RDX, Registers::D},   {RSI, Registers::SI},
+                {RDI, Registers::DI},  {RBP, Registers::BP},
+                {R8, Registers::R8},   {R9, Registers::R9},
+                {R10, Registers::R10}, {R11, Registers::R11},
+                {R12, Registers::R12}, {R13, Registers::R13},
+                {R14, Registers::R14}, {R15, Registers::R15}};
+  for (auto [gpr, name] : direct)
+    c.storeToRcx(gpr, registerOffset(name));
+
+  // the saved ones go through rdx: mov rdx, [rsp + n]
+  c.emit({0x48, 0x8b, 0x14, 0x24});
+  c.storeToRcx(RDX, registerOffset(Registers::C));
+  c.emit({0x48, 0x8b, 0x54, 0x24, 0x08});
+  c.storeToRcx(RDX, registerOffset(Registers::B));
+  c.emit({0x48, 0x8b, 0x54, 0x24, 0x10});
+  c.storeToRcx(RDX, registerOffset(Registers::A));
+  // lea rdx, [rsp + 4 * 8 + redZone]
+  c.emit({0x48, 0x8d, 0x94, 0x24});
+  c.emit32(4 * 8 + redZone);
+  c.storeToRcx(RDX, registerOffset(Registers::SP));
+  c.emit({0x48, 0xba}); // movabs rdx, probeAddress
+  c.emit64(probeAddress);
+  c.storeToRcx(RDX, registerOffset(Registers::IP));
+  // mov rdx, [rcx + D]
+  c.emit({0x48, 0x8b, 0x91});
+  c.emit32(registerOffset(Registers::D));
+
+  // publish: [rcx] = position + 1
+  c.emit({0x48, 0x8d, 0x5b, 0x01}); // lea rbx, [rbx + 1]
+  c.emit({0x48, 0x89, 0x19});       // mov [rcx], rbx
+
+  // pop rcx; pop rbx; pop rax; popfq
+  c.emit({0x59, 0x5b, 0x58, 0x9d});
+  // lea rsp, [rsp + 128]
+  c.emit({0x48, 0x8d, 0xa4, 0x24});
+  c.emit32(redZone);
+
+  // the original code, moved to the trampoline's address
+  c.emit(relocateInstructions(originalCode, probeAddress, address + c.size(),
+                              originalCode.size()));
+
+  // jmp to the instruction following the original code
+  addr_t returnAddress = probeAddress + originalCode.size();
+  c.emit({0xe9});
+  c.emit32(checkedRel32(std::int64_t(returnAddress) -
+                        std::int64_t(address + c.size() + 4)));
+  return c.take();
+}
+
+std::vector<std::uint8_t>
+relocateInstructions(std::span<const std::uint8_t> code, addr_t from,
+                     addr_t to, std::size_t minLength) {
+  std::vector<std::uint8_t> out;
+  while (out.size() < minLength) {
+    std::size_t offset = out.size();
+    auto instruction = decodeInstruction(code.subspan(offset));
+    if (!instruction) {
+      throw std::runtime_error(fmt::format(
+          "Unable to decode instruction at 0x{:x}", from + offset));
+    }
+    if (instruction->changesControlFlow) {
+      throw std::runtime_error(fmt::format(
+          "Unable to relocate control flow instruction at 0x{:x}",
+          from + offset));
+    }
+
+    out.insert(out.end(), code.begin() + offset,
+               code.begin() + offset + instruction->length);
+
+    if (instruction->ripDisplacementOffset != 0) {
+      std::uint8_t *disp =
+          out.data() + offset + instruction->ripDisplacementOffset;
+      std::int32_t value;
+      std::memcpy(&value, disp, 4);
+      std::int32_t moved = checkedRel32(value + std::int64_t(from) -
+                                        std::int64_t(to));
+      std::memcpy(disp, &moved, 4);
+    }
+  }
+  return out;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
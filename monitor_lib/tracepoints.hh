@@ -0,0 +1,75 @@
+#pragma once
+
+#include "registers.hh"
+#include "shared_memory.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+using tracepoint_id = std::uint32_t;
+
+// registers of the process when it passed a fast tracepoint
+struct TracepointHit {
+  tracepoint_id tracepoint;
+  Registers registers;
+};
+
+// Ring of tracepoint hits in memory shared with the traced process, where it
+// is written to by the trampolines. A trampoline reserves a slot by
+// atomically incrementing the head, and publishes it by writing the slot's
+// sequence number last. Writers never wait: slots not drained in time are
+// overwritten, and counted as lost by the reader.
+class TracepointRing {
+public:
+  explicit TracepointRing(std::uint32_t capacity = 1 << 16);
+
+  int fd() const { return _memory.fd(); }
+  std::size_t size() const { return _memory.size(); }
+
+  // Appends hits recorded since the previous call, returns the number of
+  // hits lost in the meantime. Can be called while the process runs.
+  std::uint64_t drain(std::vector<TracepointHit> &hits);
+
+  // Machine code of a trampoline placed at `address`, for a tracepoint
+  // replacing `originalCode` at `probeAddress`. It records the registers in
+  // the ring mapped at `ringAddress` in the process, then runs the original
+  // code and jumps back after it.
+  std::vector<std::uint8_t>
+  makeTrampoline(tracepoint_id id, addr_t address, addr_t ringAddress,
+                 addr_t probeAddress,
+                 std::span<const std::uint8_t> originalCode) const;
+
+private:
+  struct Header {
+    std::atomic<std::uint64_t> head; // next slot to write
+  };
+
+  struct Slot {
+    std::atomic<std::uint64_t> sequence; // position + 1 when published
+    std::uint64_t tracepoint;
+    std::uint64_t registers[Registers::NUM_REGISTERS];
+  };
+
+  static constexpr std::size_t slotsOffset = 64;
+
+  Header &header() const { return *static_cast<Header *>(_memory.data()); }
+  Slot &slot(std::uint64_t position) const;
+
+  std::uint32_t _capacity;
+  SharedMemory _memory;
+  std::uint64_t _tail = 0; // next slot to read
+};
+
+// Copies whole instructions covering at least `minLength` bytes of `code`,
+// located at `from`, so that they can be executed at `to`. RIP-relative
+// operands are adjusted. Throws if an instruction can't be moved.
+std::vector<std::uint8_t>
+relocateInstructions(std::span<const std::uint8_t> code, addr_t from,
+                     addr_t to, std::size_t minLength);
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "unwinder.hh"
+
+#include "logging.hh"
+
+#include <cstring>
+
+namespace Whiteboard {
+
+namespace {
+
+class StackCopy {
+public:
+  StackCopy(std::span<const std::uint8_t> data, addr_t start)
+      : _data(data), _start(start) {}
+
+  std::optional<addr_t> read(addr_t addr) const {
+    if (addr < _start || addr + sizeof(addr_t) > _start + _data.size())
+      return std::nullopt;
+    addr_t value;
+    std::memcpy(&value, _data.data() + (addr - _start), sizeof(value));
+    return value;
+  }
+
+private:
+  std::span<const std::uint8_t> _data;
+  addr_t _start;
+};
+
+} // namespace
+
+Unwinder::Unwinder() = default;
+Unwinder::~Unwinder() = default;
+
+const CfiTable *Unwinder::tableFor(const std::string &path) {
+  auto it = _tables.find(path);
+  if (it == _tables.end()) {
+    std::unique_ptr<CfiTable> table;
+    try {
+      table = std::make_unique<CfiTable>(path);
+    } catch (const std::exception &e) {
+      // remembered as missing, to not retry on every frame
+      Logging::error("Unwinder: failed to load CFI for {}: {}", path,
+                     e.what());
+    }
+    it = _tables.emplace(path, std::move(table)).first;
+  }
+  return it->second.get();
+}
+
+const CfiTable::Row *Unwinder::findRow(addr_t addr, const MemMaps &maps) {
+  const MemMaps::Mapping *mapping = maps.findMapping(addr);
+  if (!mapping || mapping->path.empty() || mapping->path[0] != '/')
+    return nullptr;
+  offset_t offset = mapping->offset + (addr - mapping->low);
+  const CfiTable *table = tableFor(mapping->path);
+  return table ? table->findRow(offset) : nullptr;
+}
+
+std::optional<addr_t> Unwinder::currentCfa(const Registers &registers,
+                                           const MemMaps &maps) {
+  const CfiTable::Row *row =
+      findRow(registers[Registers::IP].get64(), maps);
+  if (!row || row->cfaRegister == CfiTable::CfaRegister::Unsupported)
+    return std::nullopt;
+  Registers::Names base =
+      row->cfaRegister == CfiTable::CfaRegister::SP ? Registers::SP
+                                                    : Registers::BP;
+  return registers[base].get64() + row->cfaOffset;
+}
+
+std::vector<addr_t> Unwinder::unwind(const Registers &registers,
+                                     const MemMaps &maps,
+                                     std::span<const std::uint8_t> stack,
+                                     addr_t stackStart, std::size_t maxFrames) {
+
+  StackCopy copy(stack, stackStart);
+
+  addr_t ip = registers[Registers::IP].get64();
+  addr_t sp = registers[Registers::SP].get64();
+  addr_t bp = registers[Registers::BP].get64();
+
+  std::vector<addr_t> frames;
+  frames.push_back(ip);
+
+  while (frames.size() < maxFrames) {
+    // return addresses point after the call, which may be the first byte of
+    // the next function; look up the call instruction instead
+    addr_t lookupAddr = frames.size() == 1 ? ip : ip - 1;
+
+    const CfiTable::Row *row = findRow(lookupAddr, maps);
+    // after the usual prologue, the CFI describes the frame pointer chain
+    bool framePointer =
+        !row || row->cfaRegister == CfiTable::CfaRegister::Unsupported ||
+        (row->cfaRegister == CfiTable::CfaRegister::BP &&
+         row->cfaOffset == 2 * sizeof(addr_t) &&
+         row->raOffset == -std::int16_t(sizeof(addr_t)) &&
+         row->bpOffset == -2 * std::int16_t(sizeof(addr_t)));
+    std::optional<addr_t> returnAddress;
+    if (!framePointer) {
+      addr_t cfa =
+          (row->cfaRegister == CfiTable::CfaRegister::SP ? sp : bp) +
+          row->cfaOffset;
+      if (row->raOffset == 0)
+        break; // outermost frame
+      returnAddress = copy.read(cfa + row->raOffset);
+      if (row->bpOffset != 0) {
+        auto savedBp = copy.read(cfa + row->bpOffset);
+        if (!savedBp)
+          break;
+        bp = *savedBp;
+      }
+      sp = cfa;
+    } else {
+      // frame pointer chain: [BP] = caller's BP, [BP+8] = return address
+      if (bp < sp || bp % sizeof(addr_t) != 0)
+        break;
+      returnAddress = copy.read(bp + sizeof(addr_t));
+      auto savedBp = copy.read(bp);
+      if (!savedBp)
+        break;
+      sp = bp + 2 * sizeof(addr_t);
+      bp = *savedBp;
+    }
+
+    if (!returnAddress || *returnAddress == 0)
+      break;
+    ip = *returnAddress;
+    frames.push_back(ip);
+  }
+
+  return frames;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
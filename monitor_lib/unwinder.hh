@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cfi_table.hh"
+#include "mem_maps.hh"
+#include "registers.hh"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Whiteboard {
+
+using addr_t = std::uint64_t;
+
+// Walks the stack of a stopped process using CFI of the mapped modules.
+// The stack is not read by the unwinder: the caller provides a copy of it,
+// read in one go. Frames without CFI, or with the CFA at the frame pointer
+// as after the usual prologue, are walked using the frame pointer chain.
+class Unwinder {
+public:
+  Unwinder();
+  ~Unwinder();
+
+  // Returns IPs of the frames, starting with the current one.
+  // `stack` is the copy of process memory starting at `stackStart`.
+  std::vector<addr_t> unwind(const Registers &registers, const MemMaps &maps,
+                             std::span<const std::uint8_t> stack,
+                             addr_t stackStart, std::size_t maxFrames);
+
+  // canonical frame address of the current frame, nullopt without CFI
+  std::optional<addr_t> currentCfa(const Registers &registers,
+                                   const MemMaps &maps);
+
+private:
+  // CFI of the code at the address, nullptr if not known
+  const CfiTable::Row *findRow(addr_t addr, const MemMaps &maps);
+  // returns nullptr if the module has no usable CFI
+  const CfiTable *tableFor(const std::string &path);
+
+  // one table per module, loaded on first use
+  std::unordered_map<std::string, std::unique_ptr<CfiTable>> _tables;
+};
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "variables.hh"
+
+#include <fmt/format.h>
+
+#include <cctype>
+#include <cstring>
+
+namespace Whiteboard {
+
+namespace {
+
+// bytes beyond the limit are elided
+constexpr std::size_t maxFormattedBytes = 32;
+
+std::string formatBytes(std::span<const std::uint8_t> bytes) {
+  std::string out = "{";
+  for (std::size_t i = 0; i < bytes.size() && i < maxFormattedBytes; ++i)
+    out += fmt::format(" {:02x}", bytes[i]);
+  if (bytes.size() > maxFormattedBytes)
+    out += " ...";
+  return out + " }";
+}
+
+} // namespace
+
+const LocationExpression *findLocation(std::span<const LocationRange> ranges,
+                                       offset_t offset) {
+  for (const LocationRange &range : ranges) {
+    if (offset >= range.start && offset < range.end)
+      return &range.expression;
+  }
+  return nullptr;
+}
+
+std::string formatValue(const VariableType &type,
+                        std::span<const std::uint8_t> bytes) {
+  using Encoding = VariableType::Encoding;
+
+  std::size_t size = bytes.size();
+  if (type.encoding == Encoding::Other || size == 0 || size > 8 ||
+      (size & (size - 1)) != 0)
+    return formatBytes(bytes);
+
+  std::uint64_t value = 0;
+  std::memcpy(&value, bytes.data(), size); // little endian
+
+  switch (type.encoding) {
+  case Encoding::Signed: {
+    // sign-extended from the size
+    unsigned shift = 64 - 8 * size;
+    return fmt::format("{}", std::int64_t(value << shift) >> shift);
+  }
+  case Encoding::Unsigned:
+    return fmt::format("{}", value);
+  case Encoding::Char:
+    if (size == 1 && std::isprint(int(value)))
+      return fmt::format("{} '{}'", value, char(value));
+    return fmt::format("{}", value);
+  case Encoding::Bool:
+    return value ? "true" : "false";
+  case Encoding::Float:
+    if (size == sizeof(float)) {
+      float f;
+      std::memcpy(&f, bytes.data(), size);
+      return fmt::format("{}", f);
+    }
+    if (size == sizeof(double)) {
+      double d;
+      std::memcpy(&d, bytes.data(), size);
+      return fmt::format("{}", d);
+    }
+    return formatBytes(bytes);
+  case Encoding::Pointer:
+    return fmt::format("0x{:x}", value);
+  default:
+    return formatBytes(bytes);
+  }
+}
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "location_expression.hh"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Whiteboard {
+
+using offset_t = std::uint64_t;
+
+// Type of a variable, as much as needed to print its value. Typedefs and
+// qualifiers are resolved to the underlying size and encoding.
+struct VariableType {
+  enum class Encoding { Signed, Unsigned, Float, Bool, Char, Pointer, Other };
+
+  std::string name;
+  std::uint64_t size = 0; // bytes, 0 if unknown
+  Encoding encoding = Encoding::Other;
+};
+
+// location of a variable in the code range [start, end)
+struct LocationRange {
+  offset_t start = 0;
+  offset_t end = 0;
+  LocationExpression expression;
+};
+
+// the location at the offset, nullptr if the variable is not available there
+const LocationExpression *findLocation(std::span<const LocationRange> ranges,
+                                       offset_t offset);
+
+// local variable or parameter of a function
+struct Variable {
+  std::string name;
+  const VariableType *type = nullptr; // owned by FileDebugInfo
+  bool isParameter = false;
+  // no ranges where the variable is optimized out, or where its location is
+  // not supported by LocationExpression
+  std::vector<LocationRange> locations;
+};
+
+struct VariableValue {
+  const Variable *variable;
+  // nullopt if not available at the IP, or not readable
+  std::optional<std::vector<std::uint8_t>> bytes;
+};
+
+// Formats the value according to its type: numbers in decimal, pointers in
+// hex, anything else as bytes.
+std::string formatValue(const VariableType &type,
+                        std::span<const std::uint8_t> bytes);
+
+} // namespace Whiteboard
\ No newline at end of file
@@ -15,6 +15,9 @@ public:
   Word64(std::uint64_t w64) : _data(w64) {}
 
   void set8(int index, std::uint8_t v) { std::memcpy(bytes() + index, &v, 1); }
+  std::uint8_t get8(int index) const {
+    return reinterpret_cast<const std::uint8_t *>(&_data)[index];
+  }
 
   void set64(std::uint64_t v) { _data = v; }
   std::uint64_t get64() const { return _data; }
@@ -0,0 +1,539 @@
+#include "x86_decoder.hh"
+
+namespace Whiteboard {
+
+namespace {
+
+enum class Immediate {
+  None,
+  Byte,
+  Word,
+  Dword,
+  Z,      // word with the operand-size prefix, dword otherwise
+  V,      // like Z, but qword with REX.W (mov reg, imm64)
+  Enter,  // word + byte
+  Offset, // moffs: qword, dword with the address-size prefix
+};
+
+struct OpcodeInfo {
+  bool valid = true;
+  bool modrm = false;
+  Immediate immediate = Immediate::None;
+  bool changesControlFlow = false;
+};
+
+bool isLegacyPrefix(std::uint8_t b) {
+  switch (b) {
+  case 0xf0:
+  case 0xf2:
+  case 0xf3:
+  case 0x26:
+  case 0x2e:
+  case 0x36:
+  case 0x3e:
+  case 0x64:
+  case 0x65:
+  case 0x66:
+  case 0x67:
+    return true;
+  default:
+    return false;
+  }
+}
+
+OpcodeInfo invalid() { return OpcodeInfo{.valid = false}; }
+
+OpcodeInfo oneByteOpcode(std::uint8_t op) {
+  if (op < 0x40) {
+    switch (op & 7) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      return {.modrm = true};
+    case 4:
+      return {.immediate = Immediate::Byte};
+    case 5:
+      return {.immediate = Immediate::Z};
+    default:
+      // push/pop of segment registers, BCD arithmetic; not in 64-bit mode
+      return invalid();
+    }
+  }
+  if (op >= 0x50 && op <= 0x5f)
+    return {};
+  if (op >= 0x70 && op <= 0x7f)
+    return {.immediate = Immediate::Byte, .changesControlFlow = true};
+  if (op >= 0x84 && op <= 0x8f)
+    return {.modrm = true};
+  if (op >= 0x90 && op <= 0x9f)
+    return op == 0x9a ? invalid() : OpcodeInfo{};
+  if (op >= 0xa0 && op <= 0xa3)
+    return {.immediate = Immediate::Offset};
+  if (op >= 0xb0 && op <= 0xb7)
+    return {.immediate = Immediate::Byte};
+  if (op >= 0xb8 && op <= 0xbf)
+    return {.immediate = Immediate::V};
+  if (op >= 0xd8 && op <= 0xdf)
+    return {.modrm = true};
+
+  switch (op) {
+  case 0x63:
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+  case 0xf6: // immediate depends on modrm, handled by the caller
+  case 0xf7:
+  case 0xfe:
+  case 0xff:
+    return {.modrm = true};
+  case 0x68:
+  case 0xa9:
+    return {.immediate = Immediate::Z};
+  case 0x69:
+  case 0x81:
+  case 0xc7:
+    return {.modrm = true, .immediate = Immediate::Z};
+  case 0x6a:
+  case 0xa8:
+  case 0xe4:
+  case 0xe5:
+  case 0xe6:
+  case 0xe7:
+    return {.immediate = Immediate::Byte};
+  case 0x6b:
+  case 0x80:
+  case 0x83:
+  case 0xc0:
+  case 0xc1:
+  case 0xc6:
+    return {.modrm = true, .immediate = Immediate::Byte};
+  case 0x6c:
+  case 0x6d:
+  case 0x6e:
+  case 0x6f:
+  case 0xa4:
+  case 0xa5:
+  case 0xa6:
+  case 0xa7:
+  case 0xaa:
+  case 0xab:
+  case 0xac:
+  case 0xad:
+  case 0xae:
+  case 0xaf:
+  case 0xc9:
+  case 0xd7:
+  case 0xec:
+  case 0xed:
+  case 0xee:
+  case 0xef:
+  case 0xf4:
+  case 0xf5:
+  case 0xf8:
+  case 0xf9:
+  case 0xfa:
+  case 0xfb:
+  case 0xfc:
+  case 0xfd:
+    return {};
+  case 0xc2:
+  case 0xca:
+    return {.immediate = Immediate::Word, .changesControlFlow = true};
+  case 0xc3:
+  case 0xcb:
+  case 0xcc:
+  case 0xcf:
+  case 0xf1:
+    return {.changesControlFlow = true};
+  case 0xc8:
+    return {.immediate = Immediate::Enter};
+  case 0xcd:
+  case 0xe0:
+  case 0xe1:
+  case 0xe2:
+  case 0xe3:
+  case 0xeb:
+    return {.immediate = Immediate::Byte, .changesControlFlow = true};
+  case 0xe8:
+  case 0xe9:
+    return {.immediate = Immediate::Dword, .changesControlFlow = true};
+  default:
+    return invalid();
+  }
+}
+
+// opcodes following 0x0f, other than the 0x0f38 and 0x0f3a escapes
+OpcodeInfo twoByteOpcode(std::uint8_t op) {
+  if (op >= 0x80 && op <= 0x8f)
+    return {.immediate = Immediate::Dword, .changesControlFlow = true};
+  if (op >= 0xc8 && op <= 0xcf)
+    return {}; // bswap
+  if (op >= 0x30 && op <= 0x37) {
+    bool sys = op == 0x34 || op == 0x35;
+    return op == 0x36 ? invalid() : OpcodeInfo{.changesControlFlow = sys};
+  }
+
+  switch (op) {
+  case 0x04:
+  case 0x0a:
+  case 0x0c:
+  case 0x39:
+  case 0x3b:
+  case 0x3c:
+  case 0x3d:
+  case 0x3e:
+  case 0x3f:
+    return invalid();
+  case 0x05: // syscall returns to the next instruction
+  case 0x06:
+  case 0x08:
+  case 0x09:
+  case 0x0e:
+  case 0x77:
+  case 0xa0:
+  case 0xa1:
+  case 0xa2:
+  case 0xa8:
+  case 0xa9:
+    return {};
+  case 0x07:
+  case 0x0b:
+  case 0xaa:
+    return {.changesControlFlow = true};
+  case 0x0f: // 3DNow!, the opcode is in the immediate
+  case 0x70:
+  case 0x71:
+  case 0x72:
+  case 0x73:
+  case 0xa4:
+  case 0xac:
+  case 0xba:
+  case 0xc2:
+  case 0xc4:
+  case 0xc5:
+  case 0xc6:
+    return {.modrm = true, .immediate = Immediate::Byte};
+  default:
+    return {.modrm = true};
+  }
+}
+
+// VEX and EVEX encoded instructions, by opcode map (1: 0f, 2: 0f38, 3: 0f3a)
+OpcodeInfo vectorOpcode(int map, std::uint8_t op) {
+  if (map == 1 && op == 0x77)
+    return {}; // vzeroupper, vzeroall
+  if (map == 3)
+    return {.modrm = true, .immediate = Immediate::Byte};
+  if (map == 1 && ((op >= 0x70 && op <= 0x73) || op == 0xc2 ||
+                   (op >= 0xc4 && op <= 0xc6)))
+    return {.modrm = true, .immediate = Immediate::Byte};
+  if (map == 1 || map == 2)
+    return {.modrm = true};
+  return invalid();
+}
+
+} // namespace
+
+std::optional<DecodedInstruction>
+decodeInstruction(std::span<const std::uint8_t> code) {
+  if (code.size() > maxInstructionLength)
+    code = code.first(maxInstructionLength);
+
+  std::size_t pos = 0;
+  auto next = [&]() -> std::optional<std::uint8_t> {
+    if (pos >= code.size())
+      return std::nullopt;
+    return code[pos++];
+  };
+
+  bool operandSizePrefix = false;
+  bool addressSizePrefix = false;
+  bool rexW = false;
+
+  auto b = next();
+  while (b && isLegacyPrefix(*b)) {
+    operandSizePrefix |= *b == 0x66;
+    addressSizePrefix |= *b == 0x67;
+    b = next();
+  }
+  if (b && (*b & 0xf0) == 0x40) {
+    rexW = *b & 0x08;
+    b = next();
+  }
+  if (!b)
+    return std::nullopt;
+
+  OpcodeInfo info;
+  std::uint8_t opcode = *b;
+  bool oneByteMap = false;
+  if (opcode == 0xc5 || opcode == 0xc4 || opcode == 0x62) {
+    // VEX/EVEX prefix, followed by the opcode
+    int map = 1;
+    if (opcode == 0xc5) {
+      if (!next())
+        return std::nullopt;
+    } else {
+      auto p0 = next();
+      if (!p0)
+        return std::nullopt;
+      map = opcode == 0x62 ? (*p0 & 0x07) : (*p0 & 0x1f);
+      for (int i = opcode == 0x62 ? 2 : 1; i > 0; --i)
+        if (!next())
+          return std::nullopt;
+    }
+    auto op = next();
+    if (!op)
+      return std::nullopt;
+    opcode = *op;
+    info = vectorOpcode(map, opcode);
+  } else if (opcode == 0x0f) {
+    auto op = next();
+    if (!op)
+      return std::nullopt;
+    opcode = *op;
+    if (opcode == 0x38 || opcode == 0x3a) {
+      bool hasImmediate = opcode == 0x3a;
+      if (!next())
+        return std::nullopt;
+      info = {.modrm = true,
+              .immediate =
+                  hasImmediate ? Immediate::Byte : Immediate::None};
+    } else {
+      info = twoByteOpcode(opcode);
+    }
+  } else {
+    info = oneByteOpcode(opcode);
+    oneByteMap = true;
+  }
+
+  if (!info.valid)
+    return std::nullopt;
+
+  DecodedInstruction result;
+  result.changesControlFlow = info.changesControlFlow;
+
+  if (info.modrm) {
+    auto modrm = next();
+    if (!modrm)
+      return std::nullopt;
+    int mod = *modrm >> 6;
+    int reg = (*modrm >> 3) & 7;
+    int rm = *modrm & 7;
+
+    // group opcodes, whose form depends on the reg field
+    if (oneByteMap && opcode == 0xf6 && reg < 2)
+      info.immediate = Immediate::Byte;
+    if (oneByteMap && opcode == 0xf7 && reg < 2)
+      info.immediate = Immediate::Z;
+    if (oneByteMap && opcode == 0xff && reg >= 2 && reg <= 5)
+      result.changesControlFlow = true;
+
+    std::size_t displacement = 0;
+    if (mod != 3) {
+      if (rm == 4) {
+        auto sib = next();
+        if (!sib)
+          return std::nullopt;
+        if (mod == 0 && (*sib & 7) == 5)
+          displacement = 4;
+      } else if (mod == 0 && rm == 5) {
+        result.ripDisplacementOffset = pos;
+        displacement = 4;
+      }
+      if (mod == 1)
+        displacement = 1;
+      else if (mod == 2)
+        displacement = 4;
+    }
+    pos += displacement;
+  }
+
+  switch (info.immediate) {
+  case Immediate::None:
+    break;
+  case Immediate::Byte:
+    pos += 1;
+    break;
+  case Immediate::Word:
+    pos += 2;
+    break;
+  case Immediate::Dword:
+    pos += 4;
+    break;
+  case Immediate::Z:
+    pos += operandSizePrefix ? 2 : 4;
+    break;
+  case Immediate::V:
+    pos += rexW ? 8 : operandSizePrefix ? 2 : 4;
+    break;
+  case Immediate::Enter:
+    pos += 3;
+    break;
+  case Immediate::Offset:
+    pos += addressSizePrefix ? 4 : 8;
+    break;
+  }
+
+  if (pos > code.size())
+    return std::nullopt;
+  result.length = pos;
+  return result;
+}
+
+std::optional<Branch> decodeBranch(std::span<const std::uint8_t> code) {
+  auto instruction = decodeInstruction(code);
+  if (!instruction || !instruction->changesControlFlow)
+    return std::nullopt;
+  code = code.first(instruction->length);
+
+  // bnd and notrack prefixes change nothing here, others aren't expected
+  std::size_t pos = 0;
+  while (code[pos] == 0xf2 || code[pos] == 0x3e)
+    ++pos;
+  if (isLegacyPrefix(code[pos]))
+    return std::nullopt;
+  std::uint8_t rex = 0;
+  if ((code[pos] & 0xf0) == 0x40)
+    rex = code[pos++];
+
+  // little-endian, sign-extended
+  auto immediate = [&](std::size_t size) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; ++i)
+      value |= std::uint64_t(code[pos + i]) << (8 * i);
+    pos += size;
+    int shift = 64 - 8 * int(size);
+    return std::int64_t(value << shift) >> shift;
+  };
+
+  Branch branch{Branch::Kind::Jump, instruction->length};
+  std::uint8_t op = code[pos++];
+  if (op >= 0x70 && op <= 0x7f) {
+    branch.condition = Branch::Condition::Flags;
+    branch.conditionCode = op & 0x0f;
+    branch.displacement = immediate(1);
+    return branch;
+  }
+
+  switch (op) {
+  case 0xeb:
+    branch.displacement = immediate(1);
+    return branch;
+  case 0xe9:
+    branch.displacement = immediate(4);
+    return branch;
+  case 0xe8:
+    branch.kind = Branch::Kind::Call;
+    branch.displacement = immediate(4);
+    return branch;
+  case 0xe0:
+  case 0xe1:
+  case 0xe2:
+  case 0xe3: {
+    constexpr Branch::Condition conditions[] = {
+        Branch::Condition::LoopNotZero, Branch::Condition::LoopZero,
+        Branch::Condition::Loop, Branch::Condition::RcxZero};
+    branch.condition = conditions[op - 0xe0];
+    branch.displacement = immediate(1);
+    return branch;
+  }
+  case 0xc3:
+    branch.kind = Branch::Kind::Return;
+    return branch;
+  case 0xc2:
+    branch.kind = Branch::Kind::Return;
+    branch.popBytes = std::uint16_t(immediate(2));
+    return branch;
+  case 0x0f:
+    if (code[pos] < 0x80 || code[pos] > 0x8f)
+      return std::nullopt;
+    branch.condition = Branch::Condition::Flags;
+    branch.conditionCode = code[pos++] & 0x0f;
+    branch.displacement = immediate(4);
+    return branch;
+  case 0xff:
+    break;
+  default:
+    return std::nullopt;
+  }
+
+  // call and jmp through a register or memory; not the far ones
+  std::uint8_t modrm = code[pos++];
+  int mod = modrm >> 6;
+  int regField = (modrm >> 3) & 7;
+  int rm = modrm & 7;
+  if (regField != 2 && regField != 4)
+    return std::nullopt;
+  if (regField == 2)
+    branch.kind = Branch::Kind::Call;
+  if (mod == 3) {
+    branch.target = Branch::Target::Register;
+    branch.reg = rm | ((rex & 1) << 3);
+    return branch;
+  }
+
+  branch.target = Branch::Target::Memory;
+  if (rm == 4) {
+    std::uint8_t sib = code[pos++];
+    int index = ((sib >> 3) & 7) | ((rex & 2) << 2);
+    if (index != 4) {
+      branch.index = index;
+      branch.scale = 1 << (sib >> 6);
+    }
+    if (mod == 0 && (sib & 7) == 5)
+      branch.displacement = immediate(4);
+    else
+      branch.reg = (sib & 7) | ((rex & 1) << 3);
+  } else if (mod == 0 && rm == 5) {
+    branch.ripRelative = true;
+    branch.displacement = immediate(4);
+  } else {
+    branch.reg = rm | ((rex & 1) << 3);
+  }
+  if (mod == 1)
+    branch.displacement = immediate(1);
+  else if (mod == 2)
+    branch.displacement = immediate(4);
+  return branch;
+}
+
+bool conditionHolds(int conditionCode, std::uint64_t eflags) {
+  bool cf = eflags & (1 << 0);
+  bool pf = eflags & (1 << 2);
+  bool zf = eflags & (1 << 6);
+  bool sf = eflags & (1 << 7);
+  bool of = eflags & (1 << 11);
+  // pairs of a condition and its negation
+  bool holds = false;
+  switch (conditionCode >> 1) {
+  case 0:
+    holds = of;
+    break;
+  case 1:
+    holds = cf;
+    break;
+  case 2:
+    holds = zf;
+    break;
+  case 3:
+    holds = cf || zf;
+    break;
+  case 4:
+    holds = sf;
+    break;
+  case 5:
+    holds = pf;
+    break;
+  case 6:
+    holds = sf != of;
+    break;
+  case 7:
+    holds = zf || sf != of;
+    break;
+  }
+  return (conditionCode & 1) ? !holds : holds;
+}
+
+} // namespace Whiteboard
\ No newline at end of file
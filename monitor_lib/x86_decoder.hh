@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace Whiteboard {
+
+constexpr std::size_t maxInstructionLength = 15;
+
+// Result of decoding a single x86_64 instruction. Only what's needed to move
+// the instruction to another address is decoded, not the operation itself.
+struct DecodedInstruction {
+  std::uint8_t length = 0;
+  // offset of the disp32 of a RIP-relative memory operand, 0 if none
+  std::uint8_t ripDisplacementOffset = 0;
+  // jumps, calls, returns, interrupts: anything depending on its own address
+  // other than through a RIP-relative operand
+  bool changesControlFlow = false;
+};
+
+// Decodes the instruction at the start of `code`. Returns nullopt if the
+// bytes are not a valid instruction, or it doesn't fit in `code`.
+std::optional<DecodedInstruction>
+decodeInstruction(std::span<const std::uint8_t> code);
+
+// A jump, call or return, decoded to be emulated rather than moved. Register
+// numbers are those of the encoding: 0 for rax to 15 for r15.
+struct Branch {
+  enum class Kind { Jump, Call, Return };
+  // the target: relative to the next instruction, in a register, or read
+  // from memory at [base + index * scale + displacement]
+  enum class Target { Relative, Register, Memory };
+  // taken if the condition holds
+  enum class Condition {
+    Always,
+    Flags,       // of a jcc, with `conditionCode`
+    Loop,        // loop: rcx decremented, not zero
+    LoopZero,    // loope: as loop, and ZF set
+    LoopNotZero, // loopne: as loop, and ZF clear
+    RcxZero,     // jrcxz, rcx not decremented
+  };
+
+  Kind kind;
+  std::uint8_t length = 0;
+  Target target = Target::Relative;
+  std::int64_t displacement = 0;
+  int reg = -1; // target register, or memory base; -1 if none
+  int index = -1;
+  int scale = 1;
+  bool ripRelative = false; // memory base is the next instruction
+  Condition condition = Condition::Always;
+  int conditionCode = 0;
+  std::uint16_t popBytes = 0; // by ret imm16, after the return address
+};
+
+// Decodes the branch at the start of `code`. Returns nullopt for other
+// instructions and those not emulated: far jumps, interrupts, ...
+std::optional<Branch> decodeBranch(std::span<const std::uint8_t> code);
+
+// whether the condition code of a jcc holds for the flags
+bool conditionHolds(int conditionCode, std::uint64_t eflags);
+
+} // namespace Whiteboard
\ No newline at end of file